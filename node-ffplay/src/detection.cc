@@ -0,0 +1,308 @@
+#include "detection.h"
+
+extern "C" {
+#include "libavutil/intreadwrite.h"
+}
+
+#include <string.h>
+#include <math.h>
+
+// "node-ffplay-det1"
+const uint8_t detection_uuid[16] = {
+  0x6e, 0x6f, 0x64, 0x65, 0x2d, 0x66, 0x66, 0x70,
+  0x6c, 0x61, 0x79, 0x2d, 0x64, 0x65, 0x74, 0x31
+};
+
+#define SEI_TYPE_USER_DATA_UNREGISTERED 5
+
+// bounds checked little endian reads over one value
+class ValueReader {
+public:
+  ValueReader(const uint8_t *data, int size)
+  : p_(data)
+  , end_(data + size) {}
+
+  bool failed() const { return failed_; }
+
+  unsigned u8() {
+    if (!has(1))
+      return 0;
+    return *p_++;
+  }
+
+  unsigned u16() {
+    if (!has(2))
+      return 0;
+    unsigned v = AV_RL16(p_);
+    p_ += 2;
+    return v;
+  }
+
+  float f32() {
+    if (!has(4))
+      return 0;
+    uint32_t bits = AV_RL32(p_);
+    p_ += 4;
+    float v;
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+  }
+
+  string str(int size) {
+    if (!has(size))
+      return string();
+    string v((const char *)p_, size);
+    p_ += size;
+    return v;
+  }
+
+private:
+  bool has(int n) {
+    if (failed_ || end_ - p_ < n)
+      failed_ = true;
+    return !failed_;
+  }
+
+  const uint8_t *p_;
+  const uint8_t *end_;
+  bool failed_{false};
+};
+
+static int parse_value(const uint8_t *data, int size, vector<Detection_t>& dets) {
+  ValueReader r(data, size);
+  Detection_t det;
+
+  det.version = r.u8();
+  det.type = r.u8();
+  unsigned count = r.u16();
+  for (unsigned i = 0; i < count && !r.failed(); i++) {
+    DetectionObject obj;
+    obj.type = r.u8();
+    unsigned label_size = r.u8();
+    unsigned landmarks = r.u16();
+    obj.score = r.f32();
+    for (int j = 0; j < 4; j++)
+      obj.rect[j] = r.f32();
+    obj.label = r.str(label_size);
+    obj.landmarks.reserve(landmarks * 2);
+    for (unsigned j = 0; j < landmarks * 2 && !r.failed(); j++)
+      obj.landmarks.push_back(r.f32());
+    det.objects.push_back(std::move(obj));
+  }
+
+  // a truncated record is dropped as a whole
+  if (r.failed())
+    return 0;
+  dets.push_back(std::move(det));
+  return 1;
+}
+
+/* position of the next 00 00 01, or end */
+static const uint8_t *next_start_code(const uint8_t *p, const uint8_t *end) {
+  for (; end - p >= 3; p++) {
+    if (p[0] == 0 && p[1] == 0 && p[2] == 1)
+      return p;
+  }
+  return end;
+}
+
+/* calls fn for each nal unit of an annex b or length prefixed packet */
+template<typename Fn>
+static void for_each_nal(int nal_length_size, const uint8_t *data, int size, Fn fn) {
+  const uint8_t *end = data + size;
+
+  if (!nal_length_size) {
+    const uint8_t *p = next_start_code(data, end);
+    while (p < end) {
+      const uint8_t *nal = p + 3;
+      p = next_start_code(nal, end);
+      const uint8_t *nal_end = p;
+      // trailing zeros belong to the next 4 byte start code
+      while (nal_end > nal && nal_end[-1] == 0)
+        nal_end--;
+      if (nal_end > nal && !fn(nal, (int)(nal_end - nal)))
+        return;
+    }
+    return;
+  }
+
+  while (end - data >= nal_length_size) {
+    uint32_t nal_size = 0;
+    for (int i = 0; i < nal_length_size; i++)
+      nal_size = nal_size << 8 | *data++;
+    if (nal_size > (uint32_t)(end - data))
+      return;
+    if (nal_size && !fn(data, (int)nal_size))
+      return;
+    data += nal_size;
+  }
+}
+
+/* sei nal header size, 0 for other units */
+static int sei_header_size(AVCodecID codec_id, const uint8_t *nal, int size) {
+  if (codec_id == AV_CODEC_ID_H264)
+    return (nal[0] & 0x1f) == 6 ? 1 : 0;
+
+  if (codec_id == AV_CODEC_ID_HEVC && size >= 2) {
+    int type = (nal[0] >> 1) & 0x3f;
+    return type == 39 || type == 40 ? 2 : 0;
+  }
+  return 0;
+}
+
+/* coded picture data, nothing after it in the access unit is a prefix sei */
+static bool is_slice(AVCodecID codec_id, const uint8_t *nal) {
+  if (codec_id == AV_CODEC_ID_H264) {
+    int type = nal[0] & 0x1f;
+    return type >= 1 && type <= 5;
+  }
+  if (codec_id == AV_CODEC_ID_HEVC)
+    return ((nal[0] >> 1) & 0x3f) <= 31;
+  return false;
+}
+
+int detection_nal_length_size(AVCodecID codec_id, const uint8_t *extradata, int size) {
+  // annex b extradata starts with a start code, a missing one means annex b in band
+  if (!extradata || size < 4 || AV_RB24(extradata) == 1 || AV_RB32(extradata) == 1)
+    return 0;
+
+  if (codec_id == AV_CODEC_ID_H264 && size >= 7 && extradata[0] == 1)
+    return (extradata[4] & 3) + 1;
+  if (codec_id == AV_CODEC_ID_HEVC && size >= 23)
+    return (extradata[21] & 3) + 1;
+  return 0;
+}
+
+bool detection_sei_present(AVCodecID codec_id, int nal_length_size, const uint8_t *data, int size) {
+  if (codec_id != AV_CODEC_ID_H264 && codec_id != AV_CODEC_ID_HEVC)
+    return false;
+
+  // the slices are most of the packet, the units before them are enough
+  bool found = false;
+  for_each_nal(nal_length_size, data, size, [&](const uint8_t *nal, int nal_size) {
+    if (is_slice(codec_id, nal))
+      return false;
+    found = sei_header_size(codec_id, nal, nal_size) > 0;
+    return !found;
+  });
+  return found;
+}
+
+int detection_parse_sei(AVCodecID codec_id, int nal_length_size, const uint8_t *data, int size, vector<Detection_t>& dets) {
+  int found = 0;
+  vector<uint8_t> rbsp;
+
+  for_each_nal(nal_length_size, data, size, [&](const uint8_t *nal, int nal_size) {
+    if (is_slice(codec_id, nal))
+      return false;
+    int header = sei_header_size(codec_id, nal, nal_size);
+    if (!header)
+      return true;
+
+    // drop the emulation prevention bytes
+    rbsp.clear();
+    for (int i = header; i < nal_size; i++) {
+      if (i >= header + 2 && nal[i] == 3 && nal[i - 1] == 0 && nal[i - 2] == 0)
+        continue;
+      rbsp.push_back(nal[i]);
+    }
+
+    size_t pos = 0, len = rbsp.size();
+    // stops at the rbsp trailing bits
+    while (len - pos > 1) {
+      int type = 0, payload_size = 0;
+      while (pos < len && rbsp[pos] == 0xff)
+        type += rbsp[pos++];
+      if (pos >= len)
+        break;
+      type += rbsp[pos++];
+
+      while (pos < len && rbsp[pos] == 0xff)
+        payload_size += rbsp[pos++];
+      if (pos >= len)
+        break;
+      payload_size += rbsp[pos++];
+
+      if ((size_t)payload_size > len - pos)
+        break;
+
+      if (type == SEI_TYPE_USER_DATA_UNREGISTERED && payload_size >= 16 &&
+          !memcmp(&rbsp[pos], detection_uuid, 16))
+        found += parse_value(&rbsp[pos + 16], payload_size - 16, dets);
+      pos += payload_size;
+    }
+    return true;
+  });
+  return found;
+}
+
+int detection_parse_data(const uint8_t *data, int size, vector<Detection_t>& dets) {
+  if (size < 17 || memcmp(data, detection_uuid, 16))
+    return 0;
+
+  // KLV with a BER length
+  const uint8_t *p = data + 16, *end = data + size;
+  uint32_t length = *p++;
+  if (length & 0x80) {
+    int n = length & 0x7f;
+    if (n > 4 || end - p < n)
+      return 0;
+    length = 0;
+    while (n--)
+      length = length << 8 | *p++;
+  }
+  if (length > (uint32_t)(end - p))
+    return 0;
+  return parse_value(p, (int)length, dets);
+}
+
+DetectionTimeline::DetectionTimeline(size_t capacity)
+: capacity_(capacity) {}
+
+void DetectionTimeline::add(const Detection_t& det) {
+  if (isnan(det.pts))
+    return;
+
+  std::lock_guard<std::mutex> lk(mtx_);
+  if (!records_.empty()) {
+    int newest = records_.rbegin()->first.first;
+    if (det.serial < newest)
+      return;
+    // a new serial, whatever came before is not presented anymore
+    if (det.serial > newest)
+      records_.clear();
+  }
+  records_[Key(det.serial, det.pts)] = det;
+
+  while (records_.size() > capacity_) {
+    auto first = records_.begin();
+    auto last = std::prev(records_.end());
+    bool same_serial = first->first.first == last_.first;
+    if (!same_serial || fabs(first->first.second - last_.second) >= fabs(last->first.second - last_.second))
+      records_.erase(first);
+    else
+      records_.erase(last);
+  }
+}
+
+bool DetectionTimeline::find(int serial, double pts, double hold, Detection_t& det) {
+  // timestamps of a data stream may be rounded differently
+  static const double tolerance = 0.001;
+
+  std::lock_guard<std::mutex> lk(mtx_);
+  last_ = Key(serial, pts);
+
+  auto it = records_.upper_bound(Key(serial, pts + tolerance));
+  if (it == records_.begin())
+    return false;
+  --it;
+  if (it->first.first != serial || it->first.second < pts - hold)
+    return false;
+  det = it->second;
+  return true;
+}
+
+void DetectionTimeline::clear() {
+  std::lock_guard<std::mutex> lk(mtx_);
+  records_.clear();
+}
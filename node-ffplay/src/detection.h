@@ -0,0 +1,76 @@
+#pragma once
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+}
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+
+using namespace std;
+
+// Analytics results travel as H.264/HEVC SEI user_data_unregistered or as
+// KLV in a data stream, both keyed by detection_uuid. The value is little
+// endian:
+//
+//   u8 version, u8 type, u16 object count, then per object
+//   u8 type, u8 label length, u16 landmark count, f32 score,
+//   f32 x1, y1, x2, y2, the label, landmark count * (f32 x, f32 y)
+//
+// Coordinates are pixels of the coded picture.
+extern const uint8_t detection_uuid[16];
+
+struct DetectionObject {
+  int type{0};
+  float score{0};
+  float rect[4]{0, 0, 0, 0};   // x1, y1, x2, y2
+  string label;
+  vector<float> landmarks;     // x, y pairs
+};
+
+struct Detection_t {
+  double pts{0};
+  int serial{0};
+  int version{0};
+  int type{0};
+  vector<DetectionObject> objects;
+};
+
+// Records by serial and pts, looked up when a picture is presented. Lookups
+// do not consume, so pictures may come in either direction. Past capacity
+// the record farthest from the last lookup goes.
+class DetectionTimeline {
+public:
+  explicit DetectionTimeline(size_t capacity);
+
+  // records of an older serial than the newest are dropped
+  void add(const Detection_t& det);
+  // the latest record of the serial at or before pts, at most hold seconds older
+  bool find(int serial, double pts, double hold, Detection_t& det);
+  void clear();
+
+private:
+  using Key = std::pair<int, double>;
+
+  std::mutex mtx_;
+  std::map<Key, Detection_t> records_;
+  const size_t capacity_;
+  Key last_{0, 0};
+};
+
+// size of the nal length prefix of the stream's packets, from avcC/hvcC
+// extradata, or 0 for annex b
+int detection_nal_length_size(AVCodecID codec_id, const uint8_t *extradata, int size);
+
+// cheap test on the nal headers, whether a video packet carries sei at all
+bool detection_sei_present(AVCodecID codec_id, int nal_length_size, const uint8_t *data, int size);
+
+// records found in the sei of a video packet
+int detection_parse_sei(AVCodecID codec_id, int nal_length_size, const uint8_t *data, int size, vector<Detection_t>& dets);
+
+// records found in a data stream packet, KLV keyed by detection_uuid; other
+// data such as MISB KLV or timed ID3 is ignored
+int detection_parse_data(const uint8_t *data, int size, vector<Detection_t>& dets);
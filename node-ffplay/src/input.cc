@@ -0,0 +1,502 @@
+#include "input.h"
+#include "trace.h"
+
+extern "C" {
+#include "libavutil/avstring.h"
+#include "libavutil/common.h"
+#include "libavutil/mem.h"
+#include "libavutil/error.h"
+}
+
+#include <stdexcept>
+#include <errno.h>
+#include <string.h>
+#include <chrono>
+using namespace std::chrono_literals;
+
+#include <unordered_map>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#else
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+/* size of the buffer between our read callback and the demuxer */
+#define INPUT_AVIO_BUFFER_SIZE (64 * 1024)
+
+/* bounds of a single prefetch read */
+#define PREFETCH_MIN_CHUNK (64 * 1024)
+#define PREFETCH_MAX_CHUNK (1024 * 1024)
+
+/* O_DIRECT needs block aligned offsets, sizes and buffers */
+#define PREFETCH_DIRECT_ALIGN 4096
+
+///
+InputSource::~InputSource() {
+  if (avio_) {
+    av_freep(&avio_->buffer);
+    avio_context_free(&avio_);
+  }
+}
+
+bool InputSource::isLocalFile(const string& url) {
+  const char *name = avio_find_protocol_name(url.c_str());
+  return name && !strcmp(name, "file");
+}
+
+string InputSource::localPath(const string& url) {
+  const char *path = url.c_str();
+  av_strstart(path, "file:", &path);
+  return path;
+}
+
+void InputSource::createContext(int buffer_size) {
+  auto buffer = (unsigned char*)av_malloc(buffer_size);
+  if (!buffer)
+    throw runtime_error("input buffer out of memory");
+
+  avio_ = avio_alloc_context(buffer, buffer_size, 0, this, read_packet, nullptr, seek_packet);
+  if (!avio_) {
+    av_free(buffer);
+    throw runtime_error("avio_alloc_context out of memory");
+  }
+}
+
+bool InputSource::interrupted() const {
+  return int_cb_.callback && int_cb_.callback(int_cb_.opaque);
+}
+
+int InputSource::interrupt_cb(void *opaque) {
+  return static_cast<InputSource*>(opaque)->interrupted();
+}
+
+int InputSource::read_packet(void *opaque, uint8_t *buf, int size) {
+  return static_cast<InputSource*>(opaque)->read(buf, size);
+}
+
+int64_t InputSource::seek_packet(void *opaque, int64_t offset, int whence) {
+  return static_cast<InputSource*>(opaque)->seek(offset, whence);
+}
+
+///
+PrefetchInput::PrefetchInput(const string& url, int64_t window, bool direct, const AVIOInterruptCB& int_cb)
+{
+  setInterruptCallback(int_cb);
+
+#ifndef _WIN32
+  path_ = localPath(url);
+  open_flags_ = O_RDONLY;
+#ifdef O_CLOEXEC
+  open_flags_ |= O_CLOEXEC;
+#endif
+#ifdef O_DIRECT
+  if (direct) {
+    fd_ = ::open(path_.c_str(), open_flags_ | O_DIRECT);
+    if (fd_ >= 0) {
+      align_ = PREFETCH_DIRECT_ALIGN;
+      direct_ = true;
+    }
+  }
+#endif
+  if (fd_ < 0)
+    fd_ = ::open(path_.c_str(), open_flags_);
+  if (fd_ < 0)
+    throw runtime_error(string("cannot open ") + path_ + ": " + strerror(errno));
+
+  struct stat st;
+  if (!fstat(fd_, &st))
+    file_size_ = st.st_size;
+#ifdef POSIX_FADV_SEQUENTIAL
+  if (!direct_)
+    posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+#else
+  // forward through us, the callback may change after open
+  AVIOInterruptCB forward = { interrupt_cb, this };
+  int ret = avio_open2(&src_, url.c_str(), AVIO_FLAG_READ | AVIO_FLAG_DIRECT, &forward, nullptr);
+  if (ret < 0) {
+    char errbuf[128] = {0};
+    av_strerror(ret, errbuf, sizeof(errbuf));
+    throw runtime_error(string("cannot open ") + url + ": " + errbuf);
+  }
+  file_size_ = avio_size(src_);
+#endif
+
+  try {
+    // at least four reads in flight per window
+    chunk_size_ = (size_t)av_clip64(window / 4, PREFETCH_MIN_CHUNK, PREFETCH_MAX_CHUNK);
+    chunk_size_ = (chunk_size_ + align_ - 1) / align_ * align_;
+    ring_.resize(FFMAX((size_t)window, 2 * chunk_size_));
+
+#ifndef _WIN32
+    if (posix_memalign((void**)&chunk_buf_, FFMAX(align_, sizeof(void*)), chunk_size_))
+      chunk_buf_ = nullptr;
+#else
+    chunk_buf_ = (uint8_t*)av_malloc(chunk_size_);
+#endif
+    if (!chunk_buf_)
+      throw runtime_error("prefetch buffer out of memory");
+
+    createContext(INPUT_AVIO_BUFFER_SIZE);
+  } catch (...) {
+    release();
+    throw;
+  }
+
+  io_tid_ = std::thread([this] {
+    Trace::threadName("prefetch");
+    doPrefetchInThread();
+  });
+}
+
+PrefetchInput::~PrefetchInput() {
+  {
+    std::lock_guard<std::mutex> lk(mtx);
+    quit_ = true;
+  }
+  cond.notify_all();
+  if (io_tid_.joinable())
+    io_tid_.join();
+
+  release();
+}
+
+void PrefetchInput::release() {
+#ifndef _WIN32
+  free(chunk_buf_);
+  if (fd_ >= 0)
+    ::close(fd_);
+#else
+  av_free(chunk_buf_);
+  avio_closep(&src_);
+#endif
+  chunk_buf_ = nullptr;
+  fd_ = -1;
+}
+
+/* tmpfs and some FUSE and NFS mounts take O_DIRECT at open and refuse it
+ * on read, carry on through the page cache; reads stay aligned */
+bool PrefetchInput::reopenBuffered() {
+#ifndef _WIN32
+  int fd = ::open(path_.c_str(), open_flags_);
+  if (fd < 0) {
+    errno = EINVAL;   // the read error is reported
+    return false;
+  }
+  av_log(NULL, AV_LOG_VERBOSE, "%s: direct reads refused, reading buffered\n", path_.c_str());
+  ::close(fd_);
+  fd_ = fd;
+  direct_ = false;
+#ifdef POSIX_FADV_SEQUENTIAL
+  posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+  return true;
+#else
+  return false;
+#endif
+}
+
+int PrefetchInput::readAt(int64_t offset, uint8_t *buf, int size) {
+#ifndef _WIN32
+  ssize_t n;
+  for (;;) {
+    n = pread(fd_, buf, size, offset);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && errno == EINVAL && direct_ && reopenBuffered())
+      continue;
+    break;
+  }
+  if (n < 0)
+    return AVERROR(errno);
+#ifdef POSIX_FADV_WILLNEED
+  // let the kernel queue the next window while we hand this one out, the
+  // page cache is bypassed with O_DIRECT
+  if (!direct_)
+    posix_fadvise(fd_, offset + n, (off_t)ring_.size(), POSIX_FADV_WILLNEED);
+#endif
+  return (int)n;
+#else
+  int64_t r = avio_seek(src_, offset, SEEK_SET);
+  if (r < 0)
+    return (int)r;
+  int n = avio_read(src_, buf, size);
+  return n == AVERROR_EOF ? 0 : n;
+#endif
+}
+
+/* free space, counting bytes the demuxer has already consumed; an eighth
+ * of the window is kept behind the read position for short backward seeks */
+size_t PrefetchInput::writable() const {
+  int64_t consumed = pos_ - start_ - (int64_t)(ring_.size() / 8);
+  size_t evictable = consumed > 0 ? (size_t)FFMIN(consumed, (int64_t)filled_) : 0;
+  return ring_.size() - filled_ + evictable;
+}
+
+void PrefetchInput::append(const uint8_t *data, size_t size) {
+  const size_t cap = ring_.size();
+  if (cap - filled_ < size) {
+    size_t drop = size - (cap - filled_);
+    head_ = (head_ + drop) % cap;
+    start_ += drop;
+    filled_ -= drop;
+  }
+
+  size_t tail = (head_ + filled_) % cap;
+  size_t first = FFMIN(size, cap - tail);
+  memcpy(&ring_[tail], data, first);
+  if (size > first)
+    memcpy(&ring_[0], data + first, size - first);
+  filled_ += size;
+}
+
+void PrefetchInput::retarget(int64_t offset) {
+  generation_++;
+  start_ = offset / (int64_t)align_ * (int64_t)align_;
+  head_ = 0;
+  filled_ = 0;
+  eof_ = false;
+  error_ = 0;
+  cond.notify_all();
+}
+
+void PrefetchInput::doPrefetchInThread() {
+  for (;;) {
+    int64_t offset;
+    int gen;
+    {
+      std::unique_lock<std::mutex> lk(mtx);
+      cond.wait(lk, [this] {
+        return quit_ || (!eof_ && !error_ && writable() >= chunk_size_);
+      });
+      if (quit_)
+        break;
+      offset = start_ + (int64_t)filled_;
+      gen = generation_;
+    }
+
+    int n = readAt(offset, chunk_buf_, (int)chunk_size_);
+
+    {
+      std::lock_guard<std::mutex> lk(mtx);
+      if (gen != generation_)
+        continue; // retargeted while reading
+      if (n < 0)
+        error_ = n;
+      else if (n == 0)
+        eof_ = true;
+      else
+        append(chunk_buf_, n);
+    }
+    cond.notify_all();
+  }
+}
+
+int PrefetchInput::read(uint8_t *buf, int size) {
+  std::unique_lock<std::mutex> lk(mtx);
+
+  for (;;) {
+    int64_t end = start_ + (int64_t)filled_;
+    if (pos_ >= start_ && pos_ < end)
+      break;
+
+    // far outside of what is or will be buffered soon
+    if (pos_ < start_ || pos_ > end + (int64_t)chunk_size_)
+      retarget(pos_);
+    else if (eof_)
+      return AVERROR_EOF;
+    else if (error_)
+      return error_;
+
+    if (interrupted())
+      return AVERROR_EXIT;
+
+    cond.wait_for(lk, 10ms);
+  }
+
+  const size_t cap = ring_.size();
+  size_t avail = (size_t)(start_ + (int64_t)filled_ - pos_);
+  size_t n = FFMIN((size_t)size, avail);
+  size_t idx = (head_ + (size_t)(pos_ - start_)) % cap;
+  size_t first = FFMIN(n, cap - idx);
+  memcpy(buf, &ring_[idx], first);
+  if (n > first)
+    memcpy(buf + first, &ring_[0], n - first);
+  pos_ += n;
+
+  lk.unlock();
+  // consumed bytes may have made room for the next read
+  cond.notify_all();
+  return (int)n;
+}
+
+int64_t PrefetchInput::seek(int64_t offset, int whence) {
+  std::lock_guard<std::mutex> lk(mtx);
+
+  if (whence == AVSEEK_SIZE)
+    return file_size_ >= 0 ? file_size_ : AVERROR(ENOSYS);
+
+  switch (whence & ~AVSEEK_FORCE) {
+    case SEEK_SET:
+      break;
+    case SEEK_CUR:
+      offset += pos_;
+      break;
+    case SEEK_END:
+      if (file_size_ < 0)
+        return AVERROR(ENOSYS);
+      offset += file_size_;
+      break;
+    default:
+      return AVERROR(EINVAL);
+  }
+
+  if (offset < 0)
+    return AVERROR(EINVAL);
+
+  pos_ = offset;
+  if (pos_ < start_ || pos_ > start_ + (int64_t)(filled_ + chunk_size_))
+    retarget(pos_);
+
+  return pos_;
+}
+
+///
+MappedFile::~MappedFile() {
+#ifndef _WIN32
+  if (data_)
+    munmap(data_, (size_t)size_);
+#else
+  if (data_)
+    UnmapViewOfFile(data_);
+  if (mapping_)
+    CloseHandle(mapping_);
+  if (file_ && file_ != INVALID_HANDLE_VALUE)
+    CloseHandle(file_);
+#endif
+}
+
+shared_ptr<MappedFile> MappedFile::open(const string& path) {
+  static std::mutex registry_mtx;
+  static unordered_map<string, weak_ptr<MappedFile>> registry;
+
+  std::lock_guard<std::mutex> lk(registry_mtx);
+
+  for (auto it = registry.begin(); it != registry.end(); ) {
+    if (it->second.expired())
+      it = registry.erase(it);
+    else
+      ++it;
+  }
+
+  shared_ptr<MappedFile> file(new MappedFile());
+
+#ifndef _WIN32
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw runtime_error(string("cannot open ") + path + ": " + strerror(errno));
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+    ::close(fd);
+    throw runtime_error(string("cannot map empty or unknown size file ") + path);
+  }
+
+  // reuse the live mapping unless the file has changed size since
+  auto it = registry.find(path);
+  if (it != registry.end()) {
+    auto shared = it->second.lock();
+    if (shared && shared->size_ == st.st_size) {
+      ::close(fd);
+      return shared;
+    }
+  }
+
+  void *data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd); // the mapping keeps its own reference
+  if (data == MAP_FAILED)
+    throw runtime_error(string("cannot map ") + path + ": " + strerror(errno));
+
+  file->data_ = (uint8_t*)data;
+  file->size_ = st.st_size;
+#else
+  int wlen = MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, nullptr, 0);
+  std::wstring wpath(wlen > 0 ? wlen : 1, L'\0');
+  MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, &wpath[0], wlen);
+
+  file->file_ = CreateFileW(wpath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file->file_ == INVALID_HANDLE_VALUE)
+    throw runtime_error(string("cannot open ") + path);
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file->file_, &size) || size.QuadPart <= 0)
+    throw runtime_error(string("cannot map empty or unknown size file ") + path);
+
+  auto it = registry.find(path);
+  if (it != registry.end()) {
+    auto shared = it->second.lock();
+    if (shared && shared->size_ == size.QuadPart)
+      return shared;
+  }
+
+  file->mapping_ = CreateFileMappingW(file->file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!file->mapping_)
+    throw runtime_error(string("cannot map ") + path);
+
+  file->data_ = (uint8_t*)MapViewOfFile(file->mapping_, FILE_MAP_READ, 0, 0, 0);
+  if (!file->data_)
+    throw runtime_error(string("cannot map ") + path);
+  file->size_ = size.QuadPart;
+#endif
+
+  registry[path] = file;
+  return file;
+}
+
+///
+MappedInput::MappedInput(const string& url)
+: file_(MappedFile::open(localPath(url)))
+{
+  createContext(INPUT_AVIO_BUFFER_SIZE);
+}
+
+int MappedInput::read(uint8_t *buf, int size) {
+  if (pos_ >= file_->size())
+    return AVERROR_EOF;
+
+  int n = (int)FFMIN((int64_t)size, file_->size() - pos_);
+  memcpy(buf, file_->data() + pos_, n);
+  pos_ += n;
+  return n;
+}
+
+int64_t MappedInput::seek(int64_t offset, int whence) {
+  if (whence == AVSEEK_SIZE)
+    return file_->size();
+
+  switch (whence & ~AVSEEK_FORCE) {
+    case SEEK_SET:
+      break;
+    case SEEK_CUR:
+      offset += pos_;
+      break;
+    case SEEK_END:
+      offset += file_->size();
+      break;
+    default:
+      return AVERROR(EINVAL);
+  }
+
+  if (offset < 0)
+    return AVERROR(EINVAL);
+
+  pos_ = offset;
+  return pos_;
+}
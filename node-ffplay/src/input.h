@@ -0,0 +1,131 @@
+#pragma once
+
+extern "C" {
+#include "libavformat/avio.h"
+}
+
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <memory>
+
+using namespace std;
+
+// Base of the custom AVIOContext backends. The context is installed as
+// AVFormatContext::pb before avformat_open_input, and stays owned here.
+class InputSource {
+public:
+  virtual ~InputSource();
+
+  AVIOContext *avio() const { return avio_; }
+
+  // true when url is served by the "file" protocol
+  static bool isLocalFile(const string& url);
+  // url without an optional "file:" prefix
+  static string localPath(const string& url);
+
+  // may be replaced when the owning format context changes hands
+  void setInterruptCallback(const AVIOInterruptCB& int_cb) { int_cb_ = int_cb; }
+
+protected:
+  void createContext(int buffer_size);
+  bool interrupted() const;
+  static int interrupt_cb(void *opaque);
+
+  virtual int read(uint8_t *buf, int size) = 0;
+  virtual int64_t seek(int64_t offset, int whence) = 0;
+
+private:
+  static int read_packet(void *opaque, uint8_t *buf, int size);
+  static int64_t seek_packet(void *opaque, int64_t offset, int whence);
+
+  AVIOContext *avio_{nullptr};
+  AVIOInterruptCB int_cb_{0};
+};
+
+// Serves the demuxer from an in-memory ring filled by a dedicated I/O
+// thread issuing large sequential reads. A seek inside the buffered range
+// only moves the read position, any other seek retargets the prefetch.
+class PrefetchInput : public InputSource {
+public:
+  PrefetchInput(const string& url, int64_t window, bool direct, const AVIOInterruptCB& int_cb);
+  ~PrefetchInput();
+
+protected:
+  int read(uint8_t *buf, int size) override;
+  int64_t seek(int64_t offset, int whence) override;
+
+private:
+  void doPrefetchInThread();
+  void release();
+  int readAt(int64_t offset, uint8_t *buf, int size);
+  bool reopenBuffered();
+  size_t writable() const;
+  void append(const uint8_t *data, size_t size);
+  void retarget(int64_t offset);
+
+private:
+  int fd_{-1};
+  int open_flags_{0};
+  bool direct_{false};   // fd_ bypasses the page cache
+  string path_;
+  AVIOContext *src_{nullptr};
+  int64_t file_size_{-1};
+
+  uint8_t *chunk_buf_{nullptr};
+  size_t chunk_size_{0};
+  size_t align_{1};
+
+  vector<uint8_t> ring_;
+  size_t head_{0};       // ring index of start_
+  size_t filled_{0};     // bytes buffered from start_
+  int64_t start_{0};     // file offset of the first buffered byte
+  int64_t pos_{0};       // demuxer read position
+  int generation_{0};    // bumped on each retarget
+  bool eof_{false};
+  int error_{0};
+  bool quit_{false};
+
+  std::thread io_tid_;
+  std::mutex mtx;
+  std::condition_variable cond;
+};
+
+// Read-only mapping of a whole local file, shared by every MappedInput
+// opened on the same path within the process.
+class MappedFile {
+public:
+  ~MappedFile();
+
+  static shared_ptr<MappedFile> open(const string& path);
+
+  const uint8_t *data() const { return data_; }
+  int64_t size() const { return size_; }
+
+private:
+  MappedFile() = default;
+
+  uint8_t *data_{nullptr};
+  int64_t size_{0};
+#ifdef _WIN32
+  void *file_{nullptr};
+  void *mapping_{nullptr};
+#endif
+};
+
+// Serves the demuxer straight from a MappedFile, reads are plain copies
+// out of the page cache.
+class MappedInput : public InputSource {
+public:
+  explicit MappedInput(const string& url);
+
+protected:
+  int read(uint8_t *buf, int size) override;
+  int64_t seek(int64_t offset, int whence) override;
+
+private:
+  shared_ptr<MappedFile> file_;
+  int64_t pos_{0};
+};
@@ -0,0 +1,151 @@
+#include "loudnorm.h"
+
+#include <math.h>
+#include <algorithm>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/* blocks measured, 3 s short-term loudness */
+#define LOUDNORM_BLOCKS 30
+/* blocks quieter than this do not move the gain */
+#define LOUDNORM_ABSOLUTE_GATE -70.0
+#define LOUDNORM_MAX_GAIN 20.0          /* dB, either way */
+#define LOUDNORM_CEILING 0.891          /* -1 dBFS */
+
+static double lufs_to_energy(double lufs) {
+  return pow(10.0, (lufs + 0.691) / 10.0);
+}
+
+LoudnessNormalizer::LoudnessNormalizer(int sample_rate, int channels, int lookahead_ms)
+: sample_rate_(sample_rate)
+, channels_(channels)
+, lookahead_(std::min(std::max(lookahead_ms, 0), LOUDNORM_MAX_LOOKAHEAD) * sample_rate / 1000)
+, shelf_state_(channels)
+, highpass_state_(channels)
+, weights_(channels, 1.0)
+, block_size_(std::max(sample_rate / 10, 1))
+, blocks_(LOUDNORM_BLOCKS, 0.0)
+, gain_coeff_(1.0 - exp(-1.0 / (0.5 * sample_rate)))
+, delay_((size_t)(lookahead_ + 1) * channels, 0.0f)
+, peaks_(lookahead_ + 1, 0.0f)
+, attack_coeff_(1.0 - exp(-1.0 / (std::max(lookahead_, 1) / 4.0)))
+, release_coeff_(1.0 - exp(-1.0 / (0.1 * sample_rate)))
+{
+  // K-weighting, BS.1770 pre-filter and RLB high-pass for this rate
+  double f0 = 1681.974450955533;
+  double G = 3.999843853973347;
+  double Q = 0.7071752369554196;
+  double K = tan(M_PI * f0 / sample_rate);
+  double Vh = pow(10.0, G / 20.0);
+  double Vb = pow(Vh, 0.4996667741545416);
+  double a0 = 1.0 + K / Q + K * K;
+  shelf_.b0 = (Vh + Vb * K / Q + K * K) / a0;
+  shelf_.b1 = 2.0 * (K * K - Vh) / a0;
+  shelf_.b2 = (Vh - Vb * K / Q + K * K) / a0;
+  shelf_.a1 = 2.0 * (K * K - 1.0) / a0;
+  shelf_.a2 = (1.0 - K / Q + K * K) / a0;
+
+  f0 = 38.13547087602444;
+  Q = 0.5003270373238773;
+  K = tan(M_PI * f0 / sample_rate);
+  a0 = 1.0 + K / Q + K * K;
+  highpass_.b0 = 1.0;
+  highpass_.b1 = -2.0;
+  highpass_.b2 = 1.0;
+  highpass_.a1 = 2.0 * (K * K - 1.0) / a0;
+  highpass_.a2 = (1.0 - K / Q + K * K) / a0;
+
+  // 5.1 in the default order, LFE left out, surrounds weighted up
+  if (channels == 6) {
+    weights_[3] = 0.0;
+    weights_[4] = weights_[5] = 1.41;
+  }
+}
+
+double LoudnessNormalizer::run(const Biquad& f, BiquadState& s, double x) {
+  double y = f.b0 * x + s.z1;
+  s.z1 = f.b1 * x - f.a1 * y + s.z2;
+  s.z2 = f.b2 * x - f.a2 * y;
+  return y;
+}
+
+/* a 100 ms block done, the gain now aims at the short-term loudness */
+void LoudnessNormalizer::endBlock() {
+  blocks_[next_block_] = block_energy_ / block_size_;
+  next_block_ = (next_block_ + 1) % blocks_.size();
+  block_fill_ = 0;
+  block_energy_ = 0;
+
+  double gate = lufs_to_energy(LOUDNORM_ABSOLUTE_GATE);
+  double sum = 0;
+  int n = 0;
+  for (double energy : blocks_) {
+    if (energy > gate) {
+      sum += energy;
+      n++;
+    }
+  }
+  // silence keeps the gain it had
+  if (!n)
+    return;
+
+  double loudness = -0.691 + 10.0 * log10(sum / n);
+  double gain_db = std::min(std::max(target_ - loudness, -LOUDNORM_MAX_GAIN), LOUDNORM_MAX_GAIN);
+  gain_target_ = pow(10.0, gain_db / 20.0);
+}
+
+void LoudnessNormalizer::process(int16_t *samples, int nb_samples) {
+  const int slots = lookahead_ + 1;
+
+  for (int i = 0; i < nb_samples; i++) {
+    int16_t *frame = samples + (size_t)i * channels_;
+    int slot = (int)(pos_ % slots);
+    float peak = 0;
+
+    for (int c = 0; c < channels_; c++) {
+      double x = frame[c] / 32768.0;
+      double k = run(highpass_, highpass_state_[c], run(shelf_, shelf_state_[c], x));
+      block_energy_ += weights_[c] * k * k;
+
+      float y = (float)(x * gain_);
+      delay_[(size_t)slot * channels_ + c] = y;
+      peak = std::max(peak, fabsf(y));
+    }
+    if (++block_fill_ == block_size_)
+      endBlock();
+    gain_ += (gain_target_ - gain_) * gain_coeff_;
+
+    // the loudest frame of the lookahead, by a monotonic queue
+    peaks_[slot] = peak;
+    while (!window_.empty() && peaks_[window_.back() % slots] <= peak)
+      window_.pop_back();
+    window_.push_back(pos_);
+    while (window_.front() <= pos_ - slots)
+      window_.pop_front();
+    float window_peak = peaks_[window_.front() % slots];
+
+    double required = window_peak > LOUDNORM_CEILING ? LOUDNORM_CEILING / window_peak : 1.0;
+    limit_ += (required - limit_) * (required < limit_ ? attack_coeff_ : release_coeff_);
+
+    // out goes the oldest frame, the one the lookahead has just passed over
+    int out = (int)((pos_ + 1) % slots);
+    for (int c = 0; c < channels_; c++) {
+      double y = delay_[(size_t)out * channels_ + c] * limit_ * 32768.0;
+      frame[c] = (int16_t)std::min(std::max(lrint(y), -32768L), 32767L);
+    }
+    pos_++;
+  }
+}
+
+void LoudnessNormalizer::flush() {
+  std::fill(delay_.begin(), delay_.end(), 0.0f);
+  std::fill(peaks_.begin(), peaks_.end(), 0.0f);
+  window_.clear();
+  for (auto& s : shelf_state_)
+    s = BiquadState();
+  for (auto& s : highpass_state_)
+    s = BiquadState();
+  limit_ = 1.0;
+}
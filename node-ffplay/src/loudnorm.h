@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdint.h>
+#include <deque>
+#include <vector>
+
+using namespace std;
+
+#define LOUDNORM_DEFAULT_TARGET -23.0   /* LUFS, EBU R128 */
+#define LOUDNORM_MAX_LOOKAHEAD 50       /* ms */
+
+// Single pass loudness normalization of interleaved s16 audio. Loudness is
+// measured BS.1770 style, K-weighted over the last 3 seconds with an
+// absolute gate, and the gain follows it slowly. A peak limiter with a short
+// lookahead keeps the boosted signal under -1 dBFS; the lookahead is the only
+// delay added.
+class LoudnessNormalizer {
+public:
+  LoudnessNormalizer(int sample_rate, int channels, int lookahead_ms);
+
+  bool accepts(int sample_rate, int channels) const {
+    return sample_rate == sample_rate_ && channels == channels_;
+  }
+
+  void setTarget(double lufs) { target_ = lufs; }
+  // seconds the output lags the input
+  double latency() const { return (double)lookahead_ / sample_rate_; }
+
+  // in place, nb_samples per channel
+  void process(int16_t *samples, int nb_samples);
+  // drops the delayed audio after a seek, the measured loudness stays
+  void flush();
+
+private:
+  struct Biquad {
+    double b0, b1, b2, a1, a2;
+  };
+  struct BiquadState {
+    double z1{0}, z2{0};
+  };
+
+  static double run(const Biquad& f, BiquadState& s, double x);
+  void endBlock();
+
+  const int sample_rate_;
+  const int channels_;
+  const int lookahead_;      // frames
+  double target_{LOUDNORM_DEFAULT_TARGET};
+
+  // measurement
+  Biquad shelf_, highpass_;
+  vector<BiquadState> shelf_state_, highpass_state_;
+  vector<double> weights_;
+  const int block_size_;     // 100 ms
+  int block_fill_{0};
+  double block_energy_{0};
+  vector<double> blocks_;    // mean square of the last 3 seconds of blocks
+  size_t next_block_{0};
+
+  // gain
+  double gain_{1.0};
+  double gain_target_{1.0};
+  const double gain_coeff_;
+
+  // limiter
+  vector<float> delay_;      // lookahead_ + 1 frames
+  vector<float> peaks_;
+  int64_t pos_{0};
+  std::deque<int64_t> window_;   // positions of decreasing peaks in the lookahead
+  double limit_{1.0};
+  const double attack_coeff_;
+  const double release_coeff_;
+};
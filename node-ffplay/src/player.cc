@@ -26,6 +26,9 @@ extern "C" {
 }
 
 #include <chrono>
+#include <algorithm>
+#include <future>
+#include <sys/stat.h>
 using namespace std::chrono_literals;
 
 void ff_init() {
@@ -395,6 +398,113 @@ static int opt_format(void *optctx, const char *opt, const char *arg)
   return 0;
 }
 
+static int opt_prefetch(void *optctx, const char *opt, const char *arg)
+{
+  auto ctx = (PlayBackContext*)optctx;
+  ctx->prefetch_size = static_cast<int64_t>(parse_number_or_die(opt, arg, OPT_INT64, 0, INT_MAX));
+  return 0;
+}
+
+static int opt_prefetch_direct(void *optctx, const char *opt, const char *arg)
+{
+  auto ctx = (PlayBackContext*)optctx;
+  ctx->prefetch_direct = true;
+  return 0;
+}
+
+static int opt_mmap(void *optctx, const char *opt, const char *arg)
+{
+  auto ctx = (PlayBackContext*)optctx;
+  ctx->mmap_input = true;
+  return 0;
+}
+
+static int opt_fast_start(void *optctx, const char *opt, const char *arg)
+{
+  auto ctx = (PlayBackContext*)optctx;
+  ctx->fast_start = true;
+  return 0;
+}
+
+static int opt_convert_threads(void *optctx, const char *opt, const char *arg)
+{
+  auto ctx = (PlayBackContext*)optctx;
+  ctx->convert_threads = (int)parse_number_or_die(opt, arg, OPT_INT, 0, MAX_CONVERT_THREADS);
+  return 0;
+}
+
+static int opt_out_pix_fmt(void *optctx, const char *opt, const char *arg)
+{
+  auto ctx = (PlayBackContext*)optctx;
+  string list = arg;
+  ctx->out_pix_fmts.clear();
+
+  for (size_t begin = 0; begin <= list.size();) {
+    size_t end = list.find(',', begin);
+    if (end == string::npos)
+      end = list.size();
+    string name = list.substr(begin, end - begin);
+    begin = end + 1;
+
+    AVPixelFormat fmt = av_get_pix_fmt(name.c_str());
+    auto desc = av_pix_fmt_desc_get(fmt);
+    if (!desc || desc->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_BITSTREAM))
+      throw runtime_error(string("invalid output pixel format ") + name);
+    ctx->out_pix_fmts.push_back(fmt);
+  }
+  return 0;
+}
+
+static int opt_loudnorm(void *optctx, const char *opt, const char *arg)
+{
+  auto ctx = (PlayBackContext*)optctx;
+  ctx->loudnorm = true;
+  return 0;
+}
+
+static int opt_loudnorm_target(void *optctx, const char *opt, const char *arg)
+{
+  auto ctx = (PlayBackContext*)optctx;
+  ctx->loudnorm_target = parse_number_or_die(opt, arg, OPT_DOUBLE, -70, 0);
+  return 0;
+}
+
+static int opt_loudnorm_lookahead(void *optctx, const char *opt, const char *arg)
+{
+  auto ctx = (PlayBackContext*)optctx;
+  ctx->loudnorm_lookahead = (int)parse_number_or_die(opt, arg, OPT_INT, 0, LOUDNORM_MAX_LOOKAHEAD);
+  return 0;
+}
+
+static int opt_convert_in_decoder(void *optctx, const char *opt, const char *arg)
+{
+  auto ctx = (PlayBackContext*)optctx;
+  ctx->convert_in_decoder = true;
+  return 0;
+}
+
+static int opt_convert_size(void *optctx, const char *opt, const char *arg)
+{
+  auto ctx = (PlayBackContext*)optctx;
+  if (av_parse_video_size(&ctx->convert_width, &ctx->convert_height, arg) < 0)
+    throw runtime_error(string("invalid size ") + arg);
+  return 0;
+}
+
+static int opt_seek_skip_loop_filter(void *optctx, const char *opt, const char *arg)
+{
+  auto ctx = (PlayBackContext*)optctx;
+  ctx->seek_skip_loop_filter = true;
+  return 0;
+}
+
+static int opt_shared_source(void *optctx, const char *opt, const char *arg)
+{
+  auto ctx = (PlayBackContext*)optctx;
+  ctx->shared_source = true;
+  return 0;
+}
+
 static int opt_fast(void *optctx, const char *opt, const char *arg)
 {
   auto ctx = (PlayBackContext*)optctx;
@@ -452,6 +562,41 @@ static int opt_infbuf(void *optctx, const char *opt, const char *arg)
   return 0;
 }
 
+static int opt_max_queue_size(void *optctx, const char *opt, const char *arg)
+{
+  auto ctx = (PlayBackContext*)optctx;
+  ctx->max_queue_size = static_cast<int64_t>(parse_number_or_die(opt, arg, OPT_INT64, 0, INT64_MAX));
+  return 0;
+}
+
+static int opt_min_frames(void *optctx, const char *opt, const char *arg)
+{
+  auto ctx = (PlayBackContext*)optctx;
+  ctx->min_frames = static_cast<int>(parse_number_or_die(opt, arg, OPT_INT64, 0, INT_MAX));
+  return 0;
+}
+
+static int opt_buffer_duration(void *optctx, const char *opt, const char *arg)
+{
+  auto ctx = (PlayBackContext*)optctx;
+  ctx->buffer_duration = parse_number_or_die(opt, arg, OPT_DOUBLE, 0, 3600);
+  return 0;
+}
+
+static int opt_max_buffer_duration(void *optctx, const char *opt, const char *arg)
+{
+  auto ctx = (PlayBackContext*)optctx;
+  ctx->max_buffer_duration = parse_number_or_die(opt, arg, OPT_DOUBLE, 0, 3600);
+  return 0;
+}
+
+static int opt_adaptive_buffer(void *optctx, const char *opt, const char *arg)
+{
+  auto ctx = (PlayBackContext*)optctx;
+  ctx->adaptive_buffer = !!parse_number_or_die(opt, arg, OPT_INT, 0, 1);
+  return 0;
+}
+
 #if defined(BUILD_WITH_AUDIO_FILTER) || defined(BUILD_WITH_VIDEO_FILTER)
 static int opt_add_vfilter(void *optctx, const char *opt, const char *arg)
 {
@@ -537,6 +682,13 @@ static int opt_show_status(void *optctx, const char *opt, const char *arg)
   return 0;
 }
 
+static int opt_stats_interval(void *optctx, const char *opt, const char *arg)
+{
+  auto ctx = (PlayBackContext*)optctx;
+  ctx->stats_interval = parse_number_or_die(opt, arg, OPT_DOUBLE, 0.03, 3600);
+  return 0;
+}
+
 static const OptionDef options[] = {
     { "loglevel",    HAS_ARG,              opt_loglevel,          "set logging level", "loglevel" },
     { "v",           HAS_ARG,              opt_loglevel,          "set logging level", "loglevel" },
@@ -553,8 +705,21 @@ static const OptionDef options[] = {
     { "t",           HAS_ARG,              opt_duration,          "play  \"duration\" seconds of audio/video", "duration" },
     { "bytes",       HAS_ARG,              opt_seek_by_bytes,     "seek by bytes 0=off 1=on -1=auto", "val" },
     { "seek_interval", HAS_ARG,            opt_seek_interval,     "set seek interval for left/right keys, in seconds", "seconds" },
+    { "convert_threads", HAS_ARG | OPT_EXPERT, opt_convert_threads, "threads converting pictures to yuv420p, 0 = auto", "n" },
+    { "out_pix_fmt", HAS_ARG | OPT_EXPERT, opt_out_pix_fmt,       "pixel formats handed over as decoded, others are converted to the first", "fmt[,fmt...]" },
+    { "convert_in_decoder", OPT_BOOL | OPT_EXPERT, opt_convert_in_decoder, "convert pictures before they are queued for display", "" },
+    { "convert_size", HAS_ARG | OPT_EXPERT, opt_convert_size,     "scale the pictures converted before queueing", "WxH" },
+    { "loudnorm",    OPT_BOOL,             opt_loudnorm,          "normalize the audio loudness", "" },
+    { "loudnorm_target", HAS_ARG | OPT_EXPERT, opt_loudnorm_target, "loudness aimed at in LUFS", "lufs" },
+    { "loudnorm_lookahead", HAS_ARG | OPT_EXPERT, opt_loudnorm_lookahead, "peak limiter lookahead in ms, added to the audio delay", "ms" },
+    { "seek_skip_loop_filter", OPT_BOOL | OPT_EXPERT, opt_seek_skip_loop_filter, "skip loop filtering before an accurate seek target, the target may show artifacts", "" },
     { "volume",      HAS_ARG,              opt_volume,            "set startup volume 0=min 100=max", "volume" },
     { "f",           HAS_ARG,              opt_format,            "force format", "fmt" },
+    { "prefetch",    HAS_ARG | OPT_EXPERT, opt_prefetch,          "read local files ahead on an I/O thread with this window", "bytes" },
+    { "prefetch_direct", OPT_BOOL | OPT_EXPERT, opt_prefetch_direct, "bypass the page cache for prefetch reads where supported", "" },
+    { "mmap",        OPT_BOOL | OPT_EXPERT, opt_mmap,             "memory map local files", "" },
+    { "fast_start",  OPT_BOOL,             opt_fast_start,        "bounded stream probing, reuse parameters of a previous open", "" },
+    { "shared_source", OPT_BOOL | OPT_EXPERT, opt_shared_source,  "share one demuxer with other players of the same url", "" },
     { "fast",        OPT_BOOL | OPT_EXPERT,opt_fast,              "non spec compliant optimizations", "" },
     { "genpts",      OPT_BOOL | OPT_EXPERT,opt_genpts,            "generate pts", "" },
     { "drp",         HAS_ARG | OPT_EXPERT, opt_drp,               "let decoder reorder pts 0=off 1=on -1=auto", ""},
@@ -562,6 +727,11 @@ static const OptionDef options[] = {
     { "sync",        HAS_ARG | OPT_EXPERT, opt_sync,              "set audio-video sync. type (type=audio/video/ext)", "type" },
     { "framedrop",   OPT_BOOL | OPT_EXPERT, opt_framedrop,        "drop frames when cpu is too slow", "" },
     { "infbuf",      OPT_BOOL | OPT_EXPERT, opt_infbuf,           "don't limit the input buffer size (useful with realtime streams)", "" },
+    { "max_queue_size", HAS_ARG | OPT_EXPERT, opt_max_queue_size, "byte budget of the packet queues", "bytes" },
+    { "min_frames",  HAS_ARG | OPT_EXPERT, opt_min_frames,        "minimum packets queued per stream before reading pauses", "count" },
+    { "buffer_duration", HAS_ARG,          opt_buffer_duration,   "read-ahead wanted per stream", "seconds" },
+    { "max_buffer_duration", HAS_ARG | OPT_EXPERT, opt_max_buffer_duration, "upper bound of the adaptive read-ahead", "seconds" },
+    { "adaptive_buffer", OPT_BOOL | OPT_EXPERT, opt_adaptive_buffer, "grow read-ahead on slow sources, shrink it on the byte budget", "" },
 #if defined(BUILD_WITH_AUDIO_FILTER) || defined(BUILD_WITH_VIDEO_FILTER)
     { "vf",          OPT_EXPERT | HAS_ARG, opt_add_vfilter,       "set video filters", "filter_graph" },
     { "af",          HAS_ARG,              opt_afilters,          "set audio filters", "filter_graph" },
@@ -573,7 +743,8 @@ static const OptionDef options[] = {
     { "acodec",      HAS_ARG | OPT_EXPERT, opt_acodec,            "force audio decoder",    "decoder_name" },
     { "scodec",      HAS_ARG | OPT_EXPERT, opt_scodec,            "force subtitle decoder", "decoder_name" },
     { "vcodec",      HAS_ARG | OPT_EXPERT, opt_vcodec,            "force video decoder",    "decoder_name" },
-    { "stats",       OPT_BOOL | OPT_EXPERT,opt_show_status,       "show status", "" },
+    { "stats",       OPT_BOOL | OPT_EXPERT,opt_show_status,       "emit the stats event periodically", "" },
+    { "stats_interval", HAS_ARG | OPT_EXPERT, opt_stats_interval, "period of the stats event", "seconds" },
     { NULL, },
 };
 
@@ -651,8 +822,6 @@ static void parse_options(void *optctx, int argc, char **argv, const OptionDef *
     }
 }
 
-#define MAX_QUEUE_SIZE (15 * 1024 * 1024)
-#define MIN_FRAMES 25
 #define EXTERNAL_CLOCK_MIN_FRAMES 2
 #define EXTERNAL_CLOCK_MAX_FRAMES 10
 
@@ -682,11 +851,51 @@ static void parse_options(void *optctx, int argc, char **argv, const OptionDef *
 /* we use about AUDIO_DIFF_AVG_NB A-V differences to make the average */
 #define AUDIO_DIFF_AVG_NB   20
 
+/* adaptive read-ahead: minimum interval between two adjustments, and the step factors */
+#define READ_AHEAD_ADJUST_INTERVAL 1000000
+#define READ_AHEAD_GROW   1.5
+#define READ_AHEAD_SHRINK 0.8
+
+/* probing limits of the fast start mode, unless set by the user */
+#define FAST_START_PROBESIZE        (256 * 1024)
+#define FAST_START_ANALYZE_DURATION 500000
+
+/* pictures are cut in bands of at least this many rows for conversion */
+#define CONVERT_SLICE_MIN_HEIGHT 256
+
+/* samples kept for the latency percentiles */
+#define LATENCY_WINDOW_SIZE 1024
+
+/* detection records kept around the presented picture */
+#define MAX_DETECTION_RECORDS 512
+/* a record is shown with later pictures for at most this many seconds */
+#define DETECTION_HOLD 0.5
+
+/* a scrub position held this long is refined to the exact frame */
+#define SCRUB_REFINE_DELAY 250000
+
+/* decoder and display rates are sampled this often */
+#define STATS_FPS_INTERVAL 1000000
+/* how often getStats() is refreshed */
+#define STATS_SNAPSHOT_INTERVAL 100000
+/* the snapshot stops being refreshed this long after the last getStats() */
+#define STATS_REQUEST_TIMEOUT 5000000
+
+/* startup is reported without the phases not reached after this long */
+#define STARTUP_REPORT_TIMEOUT 10000000
+
+/* number of sources whose probed stream parameters are remembered */
+#define PROBE_CACHE_SIZE 32
+
 /* polls for possible required screen refresh at least this often, should be less than 1/fps */
 #define REFRESH_RATE 0.01
 
 #define USE_ONEPASS_SUBTITLE_RENDER 1
 
+const double av_drift_bounds[AV_DRIFT_BUCKETS] = {
+  0.005, 0.01, 0.02, 0.04, 0.08, 0.16, 0.32, INFINITY
+};
+
 static AVPacket special_flush_pkt{0};
 
 class GlobalInit { 
@@ -781,7 +990,7 @@ int PacketQueue::put_private(std::unique_lock<std::mutex>& lk, AVPacket *pkt, in
 
   if (specified_serial < 0)
     specified_serial = serial_;
-	pkts_.emplace(std::pair<int, AVPacket>{ specified_serial, *pkt });
+	pkts_.push(Entry{ *pkt, specified_serial, av_gettime_relative() });
 
 	this->nb_packets++;
 	size_ += pkt->size + sizeof(*pkt);
@@ -794,6 +1003,7 @@ int PacketQueue::put_private(std::unique_lock<std::mutex>& lk, AVPacket *pkt, in
 
 int PacketQueue::put(AVPacket *pkt, int specified_serial)
 {
+  TRACE_SCOPE("PacketQueue::put");
   std::unique_lock<std::mutex> lk(mtx);
   int ret = put_private(lk, pkt, specified_serial);
 
@@ -815,8 +1025,12 @@ int PacketQueue::put_nullpacket(int stream_index)
 
 void PacketQueue::flush() {
   std::lock_guard<std::mutex> lk(mtx);
+  flush_private();
+}
+
+void PacketQueue::flush_private() {
 	while (!pkts_.empty()) {
-		av_packet_unref(&pkts_.front().second);
+		av_packet_unref(&pkts_.front().pkt);
 		pkts_.pop();
 	}
     
@@ -825,12 +1039,16 @@ void PacketQueue::flush() {
   duration_ = 0;
 }
 
+/* drops the old epoch and opens a new one in one step, the consumer wakes
+ * once, for the flush packet, and never sees a stale packet */
 void PacketQueue::nextSerial() {
+  std::unique_lock<std::mutex> lk(mtx);
   if (abort_request_) {
     return;
   }
-  flush();
-  start();
+  flushed_ += nb_packets;
+  flush_private();
+  put_private(lk, &special_flush_pkt, -1);
 }
 
 void PacketQueue::abort()
@@ -851,8 +1069,9 @@ void PacketQueue::start()
 }
 
 /* return < 0 if aborted, 0 if no packet and > 0 if packet.  */
-int PacketQueue::get(AVPacket *pkt, int *serial)
+int PacketQueue::get(AVPacket *pkt, int *serial, int64_t *queued_time)
 {
+  TRACE_SCOPE("PacketQueue::get");
   std::unique_lock<std::mutex> lk(mtx);
   cond.wait(lk, [this] {
     return abort_request_ || !pkts_.empty();
@@ -862,8 +1081,10 @@ int PacketQueue::get(AVPacket *pkt, int *serial)
     return -1;
   }
 
-  *serial = pkts_.front().first;
-  *pkt = pkts_.front().second;
+  *serial = pkts_.front().serial;
+  *pkt = pkts_.front().pkt;
+  if (queued_time)
+    *queued_time = pkts_.front().time;
 	pkts_.pop();
   this->nb_packets--;
   size_ -= pkt->size + sizeof(*pkt);
@@ -871,9 +1092,71 @@ int PacketQueue::get(AVPacket *pkt, int *serial)
   return 1;
 }
 
-bool PacketQueue::has_enough_packets(const AVRational& time_base) const {
+bool PacketQueue::has_enough_packets(const AVRational& time_base, int min_frames, double min_duration) const {
   return abort_request_ ||
-           nb_packets > MIN_FRAMES && (!duration_ || av_q2d(time_base) * duration_ > 1.0);
+           nb_packets > min_frames && (!duration_ || av_q2d(time_base) * duration_ > min_duration);
+}
+
+///
+void SeekMailbox::post(const SeekRequest& req) {
+  uint64_t seq = seq_.load(std::memory_order_relaxed);
+  seq_.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  method_.store(req.method, std::memory_order_relaxed);
+  pos_.store(req.pos, std::memory_order_relaxed);
+  rel_.store(req.rel, std::memory_order_relaxed);
+
+  seq_.store(seq + 2, std::memory_order_release);
+}
+
+bool SeekMailbox::take(SeekRequest& req) {
+  for (;;) {
+    uint64_t seq = seq_.load(std::memory_order_acquire);
+    if (seq & 1)
+      continue; // being written, a few stores away
+    if (seq / 2 == taken_)
+      return false;
+
+    req.method = (SeekMethod)method_.load(std::memory_order_relaxed);
+    req.pos = pos_.load(std::memory_order_relaxed);
+    req.rel = rel_.load(std::memory_order_relaxed);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (seq_.load(std::memory_order_relaxed) == seq) {
+      taken_ = seq / 2;
+      return true;
+    }
+  }
+}
+
+///
+void LatencyWindow::add(int64_t sample) {
+  std::lock_guard<std::mutex> lk(mtx);
+  if (samples_.size() < LATENCY_WINDOW_SIZE) {
+    samples_.push_back(sample);
+  } else {
+    samples_[next_] = sample;
+    next_ = (next_ + 1) % LATENCY_WINDOW_SIZE;
+  }
+}
+
+void LatencyWindow::get(LatencyStats& stats) const {
+  vector<int64_t> sorted;
+  {
+    std::lock_guard<std::mutex> lk(mtx);
+    sorted = samples_;
+  }
+  if (sorted.empty())
+    return;
+
+  std::sort(sorted.begin(), sorted.end());
+  auto at = [&sorted](double p) {
+    return sorted[(size_t)(p * (sorted.size() - 1))] / 1000000.0;
+  };
+  stats.p50 = at(0.50);
+  stats.p90 = at(0.90);
+  stats.p99 = at(0.99);
 }
 
 ///
@@ -953,6 +1236,43 @@ void FrameQueue::next()
 	cond.notify_one();
 }
 
+void SimpleFrameQueue::start() {
+  std::lock_guard<std::mutex> lk(mtx_);
+  abort_ = false;
+}
+
+void SimpleFrameQueue::abort() {
+  {
+    std::lock_guard<std::mutex> lk(mtx_);
+    abort_ = true;
+    frames_.clear();
+  }
+  cond_.notify_all();
+}
+
+bool SimpleFrameQueue::put(SimpleFrame&& frame) {
+  std::unique_lock<std::mutex> lk(mtx_);
+  cond_.wait(lk, [this] { return abort_ || frames_.size() < max_size_; });
+  if (abort_)
+    return false;
+  frames_.push_back(std::move(frame));
+  lk.unlock();
+  cond_.notify_all();
+  return true;
+}
+
+bool SimpleFrameQueue::get(SimpleFrame& frame) {
+  std::unique_lock<std::mutex> lk(mtx_);
+  cond_.wait(lk, [this] { return abort_ || !frames_.empty(); });
+  if (abort_)
+    return false;
+  frame = std::move(frames_.front());
+  frames_.pop_front();
+  lk.unlock();
+  cond_.notify_all();
+  return true;
+}
+
 void FrameQueue::push()
 {
   if (++this->windex == max_size_)
@@ -1004,6 +1324,12 @@ bool Decoder::finished() const {
   return finished_ == serial_;
 }
 
+bool Decoder::takeDrained() {
+  bool drained = drained_;
+  drained_ = false;
+  return drained;
+}
+
 Decoder::~Decoder() {
   destroy();
 }
@@ -1015,12 +1341,15 @@ Decoder::Decoder(const int& serial)
 
 void Decoder::init(AVCodecContext *avctx) {
   finished_ = 0;
+  drained_ = false;
   packet_pending_ = false;
   this->start_pts_tb = {0};
   this->next_pts = 0;
   this->next_pts_tb = {0};
 
   avctx_ = avctx;
+  skip_frame_ = avctx->skip_frame;
+  skip_loop_filter_ = avctx->skip_loop_filter;
   this->start_pts = AV_NOPTS_VALUE;
   abort_request_ = false;
 }
@@ -1034,6 +1363,7 @@ int Decoder::decodeFrame(PacketGetter packet_getter, AVFrame *frame, AVSubtitle
   int ret = AVERROR(EAGAIN);
   for (;;) {
     AVPacket pkt;
+    int64_t pkt_time = 0;
 
     if (serial_ == pkt_serial || SERIAL_HELPER_PACKET == pkt_serial) {
       do {
@@ -1042,10 +1372,16 @@ int Decoder::decodeFrame(PacketGetter packet_getter, AVFrame *frame, AVSubtitle
 
         switch (avctx_->codec_type) {
           case AVMEDIA_TYPE_VIDEO:
-            ret = avcodec_receive_frame(avctx_, frame);
+            {
+              TRACE_SCOPE("avcodec_receive_frame");
+              ret = avcodec_receive_frame(avctx_, frame);
+            }
             break;
           case AVMEDIA_TYPE_AUDIO:
-            ret = avcodec_receive_frame(avctx_, frame);
+            {
+              TRACE_SCOPE("avcodec_receive_frame");
+              ret = avcodec_receive_frame(avctx_, frame);
+            }
             if (ret >= 0) {
               AVRational tb = AVRational{1, frame->sample_rate};
               if (frame->pts != AV_NOPTS_VALUE)
@@ -1061,7 +1397,10 @@ int Decoder::decodeFrame(PacketGetter packet_getter, AVFrame *frame, AVSubtitle
         }
 
         if (ret == AVERROR_EOF) {
-          finished_ = pkt_serial;
+          if (defer_finish)
+            drained_ = true;
+          else
+            finished_ = pkt_serial;
           avcodec_flush_buffers(avctx_);
           return 0;
         }
@@ -1074,9 +1413,10 @@ int Decoder::decodeFrame(PacketGetter packet_getter, AVFrame *frame, AVSubtitle
     do {
       if (packet_pending_) {
         av_packet_move_ref(&pkt, &pending_pkt_);
+        pkt_time = pending_pkt_time_;
         packet_pending_ = false;
       } else {
-        if (packet_getter(avctx_->codec_type, avctx_->codec_id, &pkt, &pkt_serial) < 0)
+        if (packet_getter(avctx_->codec_type, avctx_->codec_id, &pkt, &pkt_serial, &pkt_time) < 0)
           return -1; // failed
       }
 
@@ -1093,20 +1433,45 @@ int Decoder::decodeFrame(PacketGetter packet_getter, AVFrame *frame, AVSubtitle
     } else {
       if (avctx_->codec_type == AVMEDIA_TYPE_SUBTITLE) {
         int got_frame = 0;
-        ret = avcodec_decode_subtitle2(avctx_, sub, &got_frame, &pkt);
+        {
+          TRACE_SCOPE("avcodec_decode_subtitle2");
+          ret = avcodec_decode_subtitle2(avctx_, sub, &got_frame, &pkt);
+        }
         if (ret < 0) {
           ret = AVERROR(EAGAIN);
         } else {
           if (got_frame && !pkt.data) {
             packet_pending_ = true;
+            pending_pkt_time_ = pkt_time;
             av_packet_move_ref(&pending_pkt_, &pkt);
           }
           ret = got_frame ? 0 : (pkt.data ? AVERROR(EAGAIN) : AVERROR_EOF);
         }
       } else {
-        if (avcodec_send_packet(avctx_, &pkt) == AVERROR(EAGAIN)) {
+        int sent;
+        bool helper = SERIAL_HELPER_PACKET == pkt_serial;
+        // pictures before a seek target are thrown away, only the ones
+        // later pictures reference need decoding
+        if (avctx_->codec_type == AVMEDIA_TYPE_VIDEO) {
+          avctx_->skip_frame = helper ? (AVDiscard)FFMAX(skip_frame_, AVDISCARD_NONREF) : skip_frame_;
+          // the reference frames lose quality too, and pass it on up to the next key frame
+          avctx_->skip_loop_filter = helper && helper_skip_loop_filter ? AVDISCARD_ALL : skip_loop_filter_;
+        }
+        // comes back with the frames of this packet as frame->reordered_opaque
+        avctx_->reordered_opaque = pkt_time;
+        int64_t begin = helper ? av_gettime_relative() : 0;
+        {
+          TRACE_SCOPE("avcodec_send_packet");
+          sent = avcodec_send_packet(avctx_, &pkt);
+        }
+        if (helper) {
+          helper_packets_++;
+          helper_time_ += av_gettime_relative() - begin;
+        }
+        if (sent == AVERROR(EAGAIN)) {
           av_log(avctx_, AV_LOG_ERROR, "Receive_frame and send_packet both returned EAGAIN, which is an API violation.\n");
           packet_pending_ = true;
+          pending_pkt_time_ = pkt_time;
           av_packet_move_ref(&pending_pkt_, &pkt);
         }
       }
@@ -1128,7 +1493,7 @@ SyncDecoder::~SyncDecoder() {
 
 int SyncDecoder::decodeBuffer(const uint8_t* data, int size, AVFrame **frame_out) {
   int pkt_serial = -1; // force get packet !
-  int ret = decodeFrame([this, data, size](AVMediaType, AVCodecID, AVPacket *pkt, int *serial) {
+  int ret = decodeFrame([this, data, size](AVMediaType, AVCodecID, AVPacket *pkt, int *serial, int64_t *) {
     av_init_packet(pkt);
     pkt->data = (uint8_t*)data;
     pkt->size = size;
@@ -1213,41 +1578,106 @@ ConverterContext::ConverterContext(AVPixelFormat fmt)
 }
 
 ConverterContext::~ConverterContext() {
+  for (auto ctx : slice_ctxs_)
+    sws_freeContext(ctx);
   if (convert_ctx)
     sws_freeContext(convert_ctx);
-  av_frame_unref(frame_);
   av_frame_free(&frame_);
-  av_freep(&buffer);
+  av_buffer_pool_uninit(&pool_);
 }
 
 int ConverterContext::convert(AVFrame *src_frame) {
+  int ret = convert(src_frame->format, src_frame->width, src_frame->height, (const uint8_t * const *)src_frame->data, src_frame->linesize);
+  // frame_ is reused, av_frame_copy_props would pile up side data on it
+  if (ret >= 0) {
+    frame_->pts = src_frame->pts;
+    frame_->color_primaries = src_frame->color_primaries;
+    frame_->color_trc = src_frame->color_trc;
+    frame_->colorspace = src_frame->colorspace;
+    frame_->color_range = src_frame->color_range;
+    frame_->chroma_location = src_frame->chroma_location;
+  }
+  return ret;
+}
+
+/* a picture of target_fmt backed by a buffer of the pool */
+int ConverterContext::getBuffer(AVFrame *frame, int width, int height, int align) {
+  int size = av_image_get_buffer_size(target_fmt, width, height, align);
+  if (size < 0)
+    return size;
+
+  if (size != pool_buffer_size_) {
+    av_buffer_pool_uninit(&pool_);
+    pool_ = av_buffer_pool_init(size, NULL);
+    pool_buffer_size_ = pool_ ? size : 0;
+  }
+  if (!pool_)
+    return AVERROR(ENOMEM);
 
-  return convert(src_frame->format, src_frame->width, src_frame->height, (const uint8_t * const *)src_frame->data, src_frame->linesize);
+  frame->buf[0] = av_buffer_pool_get(pool_);
+  if (!frame->buf[0])
+    return AVERROR(ENOMEM);
+
+  frame->format = target_fmt;
+  frame->width = width;
+  frame->height = height;
+  return av_image_fill_arrays(frame->data, frame->linesize, frame->buf[0]->data, target_fmt,
+                        width, height, align);
 }
 
 int ConverterContext::convert(int src_format, int src_width, int src_height, const uint8_t * const*pixels, int* pitch) {
+  TRACE_SCOPE("ConverterContext::convert");
 
-  int buffer_size = av_image_fill_arrays(frame_->data, frame_->linesize, buffer, target_fmt,
-                        src_width, src_height, 1);
-  if (buffer_size > buffer_size_) {
-    av_freep(&buffer);
-    buffer = (uint8_t*)av_malloc(buffer_size);
-    buffer_size_ = buffer_size;
+  // whoever still holds the previous picture keeps its buffer
+  av_frame_unref(frame_);
+  if (getBuffer(frame_, src_width, src_height, 1) < 0)
+    return -1;
 
-    av_image_fill_arrays(frame_->data, frame_->linesize, buffer, target_fmt,
-                        src_width, src_height, 1);
+  if (scale(src_format, src_width, src_height, pixels, pitch,
+            frame_->data, frame_->linesize, src_width, src_height) < 0) {
+    av_frame_unref(frame_);
+    return -1;
+  }
+  return 0;
+}
+
+int ConverterContext::convert(const AVFrame *src_frame, AVFrame *dst_frame) {
+  TRACE_SCOPE("ConverterContext::convert");
+
+  int width = dst_width > 0 ? dst_width : src_frame->width;
+  int height = dst_height > 0 ? dst_height : src_frame->height;
+  if (getBuffer(dst_frame, width, height, 32) < 0) {
+    av_frame_unref(dst_frame);
+    return -1;
+  }
+
+  if (scale(src_frame->format, src_frame->width, src_frame->height,
+            (const uint8_t * const *)src_frame->data, (int*)src_frame->linesize,
+            dst_frame->data, dst_frame->linesize, dst_frame->width, dst_frame->height) < 0) {
+    av_frame_unref(dst_frame);
+    return -1;
+  }
+
+  av_frame_copy_props(dst_frame, src_frame);
+  return 0;
+}
+
+int ConverterContext::scale(int src_format, int src_width, int src_height, const uint8_t * const*pixels, int* pitch,
+                            uint8_t * const*dst, int *dst_linesize, int width, int height) {
+  // bands are not scaled, their heights would not map to whole rows
+  if (width == src_width && height == src_height) {
+    int slices = sliceCount(src_format, src_height);
+    if (slices > 1)
+      return convertSlices(slices, src_format, src_width, src_height, pixels, pitch, dst, dst_linesize);
   }
 
   convert_ctx = sws_getCachedContext(convert_ctx,
-                        src_width, src_height, (AVPixelFormat)src_format, src_width, src_height,
+                        src_width, src_height, (AVPixelFormat)src_format, width, height,
                         target_fmt, SWS_BICUBIC, NULL, NULL, NULL);
 
   if (convert_ctx) {
-    frame_->format = target_fmt;
-    frame_->width = src_width;
-    frame_->height = src_height;
     int r = sws_scale(convert_ctx, pixels, pitch,
-                                        0, src_height, frame_->data, frame_->linesize);
+                                        0, src_height, dst, dst_linesize);
     if (r <= 0) {
             return -1;
     }
@@ -1256,6 +1686,127 @@ int ConverterContext::convert(int src_format, int src_width, int src_height, con
   return -1;
 }
 
+int ConverterContext::sliceCount(int src_format, int src_height) const {
+  auto desc = av_pix_fmt_desc_get((AVPixelFormat)src_format);
+  // a palette plane cannot be cut
+  if (!desc || desc->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_BITSTREAM))
+    return 1;
+  return FFMAX(1, FFMIN(threads, src_height / CONVERT_SLICE_MIN_HEIGHT));
+}
+
+/* rows of plane p are subsampled by this shift */
+static int plane_row_shift(const AVPixFmtDescriptor *desc, int p) {
+  return (p == 1 || p == 2) && !(desc->flags & AV_PIX_FMT_FLAG_RGB) ? desc->log2_chroma_h : 0;
+}
+
+/* converts horizontal bands as pictures of their own, in parallel. The
+ * vertical chroma filter does not see across a band edge, the bands start
+ * on chroma rows so nothing is misplaced. */
+int ConverterContext::convertSlices(int slices, int src_format, int src_width, int src_height, const uint8_t * const*pixels, int* pitch,
+                                    uint8_t * const*dst_data, int *dst_linesize) {
+  auto src_desc = av_pix_fmt_desc_get((AVPixelFormat)src_format);
+  auto dst_desc = av_pix_fmt_desc_get(target_fmt);
+  int align = 1 << FFMAX(src_desc->log2_chroma_h, dst_desc->log2_chroma_h);
+  int step = FFALIGN((src_height + slices - 1) / slices, align);
+
+  if ((int)slice_ctxs_.size() < slices)
+    slice_ctxs_.resize(slices, nullptr);
+
+  std::atomic<bool> failed{false};
+  SliceWorkers::shared().run(slices, [&](int i) {
+    TRACE_SCOPE("sws_scale slice");
+    int y = i * step;
+    int h = FFMIN(step, src_height - y);
+    if (h <= 0)
+      return;
+
+    const uint8_t *src[4] = { nullptr };
+    uint8_t *dst[4] = { nullptr };
+    for (int p = 0; p < 4; p++) {
+      if (pixels[p])
+        src[p] = pixels[p] + (y >> plane_row_shift(src_desc, p)) * pitch[p];
+      if (dst_data[p])
+        dst[p] = dst_data[p] + (y >> plane_row_shift(dst_desc, p)) * dst_linesize[p];
+    }
+
+    slice_ctxs_[i] = sws_getCachedContext(slice_ctxs_[i],
+                        src_width, h, (AVPixelFormat)src_format, src_width, h,
+                        target_fmt, SWS_BICUBIC, NULL, NULL, NULL);
+    if (!slice_ctxs_[i] || sws_scale(slice_ctxs_[i], src, pitch, 0, h, dst, dst_linesize) <= 0)
+      failed = true;
+  });
+
+  return failed ? -1 : 0;
+}
+
+///
+SliceWorkers::SliceWorkers(int threads) {
+  for (int i = 0; i < threads; i++) {
+    threads_.emplace_back([this] {
+      Trace::threadName("convert");
+      work();
+    });
+  }
+}
+
+SliceWorkers::~SliceWorkers() {
+  {
+    std::lock_guard<std::mutex> lk(mtx);
+    quit_ = true;
+  }
+  cond.notify_all();
+  for (auto& t : threads_)
+    t.join();
+}
+
+SliceWorkers& SliceWorkers::shared() {
+  // never destroyed, a player may still convert while the process exits
+  static SliceWorkers *workers = new SliceWorkers(
+      FFMAX(0, FFMIN((int)std::thread::hardware_concurrency(), MAX_CONVERT_THREADS) - 1));
+  return *workers;
+}
+
+int SliceWorkers::take(Job *job) {
+  int i = job->next++;
+  if (job->next == job->count)
+    jobs_.erase(std::find(jobs_.begin(), jobs_.end(), job));
+  return i;
+}
+
+void SliceWorkers::run(int count, const std::function<void(int)>& slice) {
+  Job job{&slice, count, 0, count};
+  std::unique_lock<std::mutex> lk(mtx);
+  jobs_.push_back(&job);
+  cond.notify_all();
+
+  // the caller works too, on its own job only
+  while (job.next < job.count) {
+    int i = take(&job);
+    lk.unlock();
+    slice(i);
+    lk.lock();
+    job.pending--;
+  }
+  done_cond.wait(lk, [&job] { return job.pending == 0; });
+}
+
+void SliceWorkers::work() {
+  std::unique_lock<std::mutex> lk(mtx);
+  for (;;) {
+    cond.wait(lk, [this] { return quit_ || !jobs_.empty(); });
+    if (quit_)
+      return;
+
+    Job *job = jobs_.front();
+    int i = take(job);
+    lk.unlock();
+    (*job->slice)(i);
+    lk.lock();
+    if (--job->pending == 0)
+      done_cond.notify_all();
+  }
+}
+
 ///
 PlayBackContext::PlayBackContext()
 : audclk(&audioSerial_)
@@ -1272,7 +1823,8 @@ PlayBackContext::PlayBackContext()
 , subtitleDecoder_(subtitleSerial_)
 , dataPacketQueue_(dataSerial_)
 , yuv_ctx_(AV_PIX_FMT_YUV420P)
-, sub_yuv_ctx_(AV_PIX_FMT_YUV420P)
+, decode_yuv_ctx_(AV_PIX_FMT_YUV420P)
+, detections_(MAX_DETECTION_RECORDS)
 {
   // default settings
   av_dict_set(&this->sws_dict, "flags", "bicubic", 0);
@@ -1294,6 +1846,7 @@ void PlayBackContext::eventLoop(int argc, char **argv) {
     throw runtime_error("An input file must be specified.");
   }
 
+  Trace::threadName("refresh");
   streamOpen();
 
   MediaEvent event;
@@ -1337,6 +1890,11 @@ void PlayBackContext::refreshLoopWaitEvent(MediaEvent *event) {
       static int64_t last_time;
       videoRefreshShowStatus(last_time);
     }
+
+    updateStats();
+
+    if (!startupReported_)
+      reportStartup();
   }
 }
 
@@ -1377,6 +1935,20 @@ int PlayBackContext::handleEvent(const MediaEvent& event, int& quit) {
   case MEDIA_CMD_SPEED:
     change_speed(event.arg1);
     return 1;
+  case MEDIA_CMD_SCRUB:
+    scrubbing_ = event.arg0 != 0;
+    return 1;
+  case MEDIA_CMD_LOUDNORM:
+    loudnorm = event.arg0 != 0;
+    if (event.arg1 != 0)
+      loudnorm_target = av_clipd(event.arg1, -70, 0);
+    return 1;
+  case MEDIA_CMD_VFILTER:
+#ifdef BUILD_WITH_VIDEO_FILTER
+    if (event.arg0 >= 0 && event.arg0 < (int)FFMAX(vfilters_list.size(), 1))
+      vfilter_idx = event.arg0;
+#endif
+    return 1;
   case MEDIA_CMD_CHAPTER:
     if (event.arg0 > 0) {
       if (this->ic->nb_chapters <= 1) {
@@ -1402,7 +1974,7 @@ int PlayBackContext::handleEvent(const MediaEvent& event, int& quit) {
         target_pts = frameIdToPts(id);
       }
       if (!this->seek_by_bytes) {
-        sendSeekRequest(SEEK_METHOD_POS, static_cast<int64_t>(target_pts * AV_TIME_BASE));
+        sendSeekRequest(scrubbing_ ? SEEK_METHOD_KEYFRAME : SEEK_METHOD_POS, static_cast<int64_t>(target_pts * AV_TIME_BASE));
       }
       return 1;
     }
@@ -1539,6 +2111,192 @@ static bool is_realtime(AVFormatContext *s)
     return false;
 }
 
+static int find_stream_info(AVFormatContext *ic, AVDictionary *codec_opts)
+{
+    AVDictionary **opts = setup_find_stream_info_opts(ic, codec_opts);
+    int orig_nb_streams = ic->nb_streams;
+
+    int err = avformat_find_stream_info(ic, opts);
+
+    for (int i = 0; i < orig_nb_streams; i++)
+      av_dict_free(&opts[i]);
+    av_freep(&opts);
+    return err;
+}
+
+/* enough known to open a decoder and an output for the stream */
+static bool stream_params_known(const AVStream *st)
+{
+    const AVCodecParameters *par = st->codecpar;
+    switch (par->codec_type) {
+    case AVMEDIA_TYPE_VIDEO:
+        return par->width > 0 && par->height > 0 && par->format != AV_PIX_FMT_NONE;
+    case AVMEDIA_TYPE_AUDIO:
+        return par->sample_rate > 0 && par->channels > 0 && par->format != AV_SAMPLE_FMT_NONE;
+    default:
+        return true;
+    }
+}
+
+/* first stream matching the user's specifier for the type, -1 without one */
+static int wanted_stream(AVFormatContext *ic, const string& spec, AVMediaType type)
+{
+    if (spec.empty())
+        return -1;
+    for (int i = 0; i < ic->nb_streams; i++) {
+        if (ic->streams[i]->codecpar->codec_type == type &&
+            avformat_match_stream_specifier(ic, ic->streams[i], spec.c_str()) > 0)
+            return i;
+    }
+    return INT_MAX;
+}
+
+/* the streams streamOpen would pick are usable after a bounded probe */
+static bool selected_streams_known(AVFormatContext *ic, const string *wanted_stream_spec, bool audio_disable)
+{
+    int video = av_find_best_stream(ic, AVMEDIA_TYPE_VIDEO,
+                                    wanted_stream(ic, wanted_stream_spec[AVMEDIA_TYPE_VIDEO], AVMEDIA_TYPE_VIDEO),
+                                    -1, NULL, 0);
+    int audio = audio_disable ? -1 :
+                av_find_best_stream(ic, AVMEDIA_TYPE_AUDIO,
+                                    wanted_stream(ic, wanted_stream_spec[AVMEDIA_TYPE_AUDIO], AVMEDIA_TYPE_AUDIO),
+                                    video, NULL, 0);
+
+    if (video < 0 && audio < 0)
+        return false;
+    if (video >= 0 && !stream_params_known(ic->streams[video]))
+        return false;
+    if (audio >= 0 && !stream_params_known(ic->streams[audio]))
+        return false;
+    return true;
+}
+
+/* stream parameters found by a previous probe of the same source, so a
+ * reopen can skip avformat_find_stream_info. Only sources of a known size
+ * are cached, a live source may change between opens. Local files also
+ * key on mtime and inode so a file rewritten in place is probed again, and
+ * the stream specifiers are part of the key since they decide which
+ * streams the probe had to resolve. */
+struct ProbeCacheEntry {
+  string url;
+  string stream_spec;
+  int64_t size;
+  int64_t mtime{0};
+  int64_t inode{0};
+  int64_t duration;
+  int64_t start_time;
+  int64_t bit_rate;
+  vector<shared_ptr<AVCodecParameters>> codecpar;
+  vector<AVRational> avg_frame_rate;
+  vector<AVRational> r_frame_rate;
+  vector<int64_t> stream_start_time;
+  vector<int64_t> stream_duration;
+};
+
+static std::mutex probe_cache_mtx;
+static std::deque<ProbeCacheEntry> probe_cache;
+
+static string probe_cache_spec(const string *wanted_stream_spec)
+{
+    string spec;
+    for (int i = 0; i < AVMEDIA_TYPE_NB; i++)
+        spec += wanted_stream_spec[i] + ";";
+    return spec;
+}
+
+/* mtime and inode of a local file, both zero for anything else */
+static void probe_cache_stat(const string& url, int64_t& mtime, int64_t& inode)
+{
+    struct stat st;
+    mtime = inode = 0;
+    if (InputSource::isLocalFile(url) && stat(InputSource::localPath(url).c_str(), &st) == 0) {
+        mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+        inode = (int64_t)st.st_ino;
+    }
+}
+
+static void probe_cache_store(const string& url, const string *wanted_stream_spec, AVFormatContext *ic)
+{
+    ProbeCacheEntry entry;
+    entry.url = url;
+    entry.size = ic->pb ? avio_size(ic->pb) : -1;
+    if (entry.size < 0)
+        return;
+    entry.stream_spec = probe_cache_spec(wanted_stream_spec);
+    probe_cache_stat(url, entry.mtime, entry.inode);
+    entry.duration = ic->duration;
+    entry.start_time = ic->start_time;
+    entry.bit_rate = ic->bit_rate;
+
+    for (int i = 0; i < ic->nb_streams; i++) {
+        AVStream *st = ic->streams[i];
+        shared_ptr<AVCodecParameters> par(avcodec_parameters_alloc(), [](AVCodecParameters *p) {
+          avcodec_parameters_free(&p);
+        });
+        if (!par || avcodec_parameters_copy(par.get(), st->codecpar) < 0)
+            return;
+        entry.codecpar.push_back(par);
+        entry.avg_frame_rate.push_back(st->avg_frame_rate);
+        entry.r_frame_rate.push_back(st->r_frame_rate);
+        entry.stream_start_time.push_back(st->start_time);
+        entry.stream_duration.push_back(st->duration);
+    }
+
+    std::lock_guard<std::mutex> lk(probe_cache_mtx);
+    for (auto it = probe_cache.begin(); it != probe_cache.end(); ++it) {
+        if (it->url == url) {
+            probe_cache.erase(it);
+            break;
+        }
+    }
+    probe_cache.push_front(std::move(entry));
+    if (probe_cache.size() > PROBE_CACHE_SIZE)
+        probe_cache.pop_back();
+}
+
+/* apply a cached probe when the demuxer found the same streams in the
+ * header, the source did not change and the same streams are wanted */
+static bool probe_cache_restore(const string& url, const string *wanted_stream_spec, AVFormatContext *ic)
+{
+    int64_t size = ic->pb ? avio_size(ic->pb) : -1;
+    if (size < 0)
+        return false;
+    int64_t mtime, inode;
+    probe_cache_stat(url, mtime, inode);
+    string spec = probe_cache_spec(wanted_stream_spec);
+
+    std::lock_guard<std::mutex> lk(probe_cache_mtx);
+    for (auto& entry : probe_cache) {
+        if (entry.url != url)
+            continue;
+
+        if (entry.size != size || entry.mtime != mtime || entry.inode != inode ||
+            entry.stream_spec != spec || entry.codecpar.size() != ic->nb_streams)
+            return false;
+        for (int i = 0; i < ic->nb_streams; i++) {
+            if (entry.codecpar[i]->codec_type != ic->streams[i]->codecpar->codec_type ||
+                entry.codecpar[i]->codec_id != ic->streams[i]->codecpar->codec_id)
+                return false;
+        }
+
+        for (int i = 0; i < ic->nb_streams; i++) {
+            AVStream *st = ic->streams[i];
+            if (avcodec_parameters_copy(st->codecpar, entry.codecpar[i].get()) < 0)
+                return false;
+            st->avg_frame_rate = entry.avg_frame_rate[i];
+            st->r_frame_rate = entry.r_frame_rate[i];
+            // used by the -ss and play range math
+            st->start_time = entry.stream_start_time[i];
+            st->duration = entry.stream_duration[i];
+        }
+        ic->duration = entry.duration;
+        ic->start_time = entry.start_time;
+        ic->bit_rate = entry.bit_rate;
+        return true;
+    }
+    return false;
+}
+
 static void print_fps(char *dst, size_t size, double d, const char *postfix)
 {
 	uint64_t v = lrintf(d * 100);
@@ -1786,35 +2544,48 @@ int64_t get_valid_channel_layout(int64_t channel_layout, int channels)
         return 0;
 }
 
-void PlayBackContext::streamOpen() {
+/* allocate ic and open the input up to the initial seek */
+void PlayBackContext::openInput() {
   bool scan_all_pmts_set = false;
   AVDictionaryEntry *t;
-  int st_index[AVMEDIA_TYPE_NB];
 
   ic = avformat_alloc_context();
   if (!ic) {
     throw runtime_error("Could not allocate context.");
   }
 
-
-  audio_volume = av_clip(audio_volume, 0, 100);
-  audio_volume = av_clip(SDL_MIX_MAXVOLUME * audio_volume / 100, 0, SDL_MIX_MAXVOLUME);
-  muted_ = false;
-
-  memset(st_index, -1, sizeof(st_index));
-  this->last_video_stream = this->video_stream = -1;
-  this->last_audio_stream = this->audio_stream = -1;
-  this->last_subtitle_stream = this->subtitle_stream = -1;
-  this->last_data_stream = this->data_stream = -1;
-  this->eof_ = false;
-
   ic->interrupt_callback.callback = decode_interrupt_cb;
   ic->interrupt_callback.opaque = this;
-  if (!av_dict_get(format_opts, "scan_all_pmts", NULL, AV_DICT_MATCH_CASE)) {
+
+  const int64_t full_probesize = ic->probesize;
+  const int64_t full_analyzeduration = ic->max_analyze_duration;
+  if (fast_start) {
+    if (!av_dict_get(format_opts, "probesize", NULL, AV_DICT_MATCH_CASE))
+      ic->probesize = FAST_START_PROBESIZE;
+    if (!av_dict_get(format_opts, "analyzeduration", NULL, AV_DICT_MATCH_CASE))
+      ic->max_analyze_duration = FAST_START_ANALYZE_DURATION;
+  }
+
+  // waiting for every program of a TS is what fast start avoids
+  if (!fast_start && !av_dict_get(format_opts, "scan_all_pmts", NULL, AV_DICT_MATCH_CASE)) {
     av_dict_set(&format_opts, "scan_all_pmts", "1", AV_DICT_DONT_OVERWRITE);
     scan_all_pmts_set = true;
   }
 
+  if (mmap_input && InputSource::isLocalFile(filename)) {
+    try {
+      input_.reset(new MappedInput(filename));
+    } catch (exception& e) {
+      av_log(NULL, AV_LOG_WARNING, "%s, falling back to regular reads\n", e.what());
+    }
+  }
+
+  if (!input_ && prefetch_size > 0 && InputSource::isLocalFile(filename))
+    input_.reset(new PrefetchInput(filename, prefetch_size, prefetch_direct, ic->interrupt_callback));
+
+  if (input_)
+    ic->pb = input_->avio();
+
   int err = avformat_open_input(&ic, filename.c_str(), iformat, &format_opts);
   if (err < 0) {
     char errbuf[128] = {0};
@@ -1825,6 +2596,7 @@ void PlayBackContext::streamOpen() {
 
     throw runtime_error(errbuf_ptr);
   }
+  markStartup(STARTUP_OPEN);
 
   if (scan_all_pmts_set)
     av_dict_set(&format_opts, "scan_all_pmts", NULL, AV_DICT_MATCH_CASE);
@@ -1838,30 +2610,34 @@ void PlayBackContext::streamOpen() {
 
   av_format_inject_global_side_data(ic);
 
-  // find_stream_info
-  {
-    AVDictionary **opts = setup_find_stream_info_opts(ic, codec_opts);
-    int orig_nb_streams = ic->nb_streams;
-
-    err = avformat_find_stream_info(ic, opts);
-
-    for (int i = 0; i < orig_nb_streams; i++)
-      av_dict_free(&opts[i]);
-    av_freep(&opts);
-
+  if (fast_start && probe_cache_restore(filename, wanted_stream_spec, ic)) {
+    av_log(NULL, AV_LOG_VERBOSE, "%s: stream parameters taken from the probe cache\n", filename.c_str());
+  } else {
+    err = find_stream_info(ic, codec_opts);
     if (err < 0) {
       throw runtime_error("could not find codec parameters.");
     }
+
+    // the bounded probe missed what the decoders need, probe with the default limits
+    if (fast_start && !selected_streams_known(ic, wanted_stream_spec, audio_disable)) {
+      av_log(NULL, AV_LOG_VERBOSE, "%s: bounded probe incomplete, probing fully\n", filename.c_str());
+      ic->probesize = full_probesize;
+      ic->max_analyze_duration = full_analyzeduration;
+      err = find_stream_info(ic, codec_opts);
+      if (err < 0) {
+        throw runtime_error("could not find codec parameters.");
+      }
+    }
+
+    if (fast_start)
+      probe_cache_store(filename, wanted_stream_spec, ic);
   }
 
+  markStartup(STARTUP_PROBE);
+
   if (ic->pb)
     ic->pb->eof_reached = 0; // FIXME hack, ffplay maybe should not use avio_feof() to test for the end
 
-  if (seek_by_bytes < 0)
-        seek_by_bytes = !!(ic->iformat->flags & AVFMT_TS_DISCONT) && strcmp("ogg", ic->iformat->name);
-
-  max_frame_duration = (ic->iformat->flags & AVFMT_TS_DISCONT) ? 10.0 : 3600.0;
-
   /* if seeking requested, we execute it */
   if (start_time != AV_NOPTS_VALUE) {
         int64_t timestamp;
@@ -1876,6 +2652,49 @@ void PlayBackContext::streamOpen() {
                     filename.c_str(), (double)timestamp / AV_TIME_BASE);
         }
   }
+}
+
+void PlayBackContext::streamOpen() {
+  int st_index[AVMEDIA_TYPE_NB];
+
+  startupBegin_ = av_gettime_relative();
+  for (auto& stamp : startupStamps_)
+    stamp = 0;
+  startupReported_ = false;
+  for (auto& count : avDrift_)
+    count = 0;
+
+  audio_volume = av_clip(audio_volume, 0, 100);
+  audio_volume = av_clip(SDL_MIX_MAXVOLUME * audio_volume / 100, 0, SDL_MIX_MAXVOLUME);
+  muted_ = false;
+
+  memset(st_index, -1, sizeof(st_index));
+  this->last_video_stream = this->video_stream = -1;
+  this->last_audio_stream = this->audio_stream = -1;
+  this->last_subtitle_stream = this->subtitle_stream = -1;
+  this->last_data_stream = this->data_stream = -1;
+  this->eof_ = false;
+
+  if (shared_source) {
+    // the first player of the url opens it, the source takes ic over
+    source_ = SharedSource::acquire(filename, [this](AVFormatContext*& ctx, std::unique_ptr<InputSource>& input) {
+      openInput();
+      ctx = ic;
+      input = std::move(input_);
+      ic = nullptr;
+    });
+    ic = source_->context();
+    // joined a running source, nothing left to open or probe
+    markStartup(STARTUP_OPEN);
+    markStartup(STARTUP_PROBE);
+  } else {
+    openInput();
+  }
+
+  if (seek_by_bytes < 0)
+        seek_by_bytes = !!(ic->iformat->flags & AVFMT_TS_DISCONT) && strcmp("ogg", ic->iformat->name);
+
+  max_frame_duration = (ic->iformat->flags & AVFMT_TS_DISCONT) ? 10.0 : 3600.0;
 
   realtime_ = is_realtime(ic);
 
@@ -1897,7 +2716,8 @@ void PlayBackContext::streamOpen() {
   for (int i = 0; i < ic->nb_streams; i++) {
         AVStream *st = ic->streams[i];
         enum AVMediaType type = st->codecpar->codec_type;
-        st->discard = AVDISCARD_ALL;
+        if (!source_)
+          st->discard = AVDISCARD_ALL;
         if (type >= 0 && wanted_stream_spec[type].size() && st_index[type] == -1)
             if (avformat_match_stream_specifier(ic, st, wanted_stream_spec[type].c_str()) > 0)
                 st_index[type] = i;
@@ -1980,10 +2800,16 @@ void PlayBackContext::streamOpen() {
   if (this->video_stream < 0 && this->audio_stream < 0) {
     throw runtime_error("No stream in media.");
   }
+  markStartup(STARTUP_CODEC_OPEN);
 
   if (infinite_buffer < 0 && this->realtime_)
     infinite_buffer = 1;
 
+  if (max_buffer_duration < buffer_duration)
+    max_buffer_duration = buffer_duration;
+  readAheadDuration_ = buffer_duration;
+  readAheadPrimed_ = false;
+
   if (this->video_stream >= 0 && this->data_stream < 0) {
     // in case data is embedded in H264/265 SEI
     data_time_base_ = this->video_st->time_base;
@@ -2003,15 +2829,67 @@ void PlayBackContext::streamOpen() {
   }
 
   abort_reading_ = false;
-  read_tid_ = std::thread([this] {
-    doReadInThread();
-  });
+  if (source_) {
+    read_tid_ = std::thread([this] {
+      Trace::threadName("read");
+      doFollowSourceInThread();
+    });
+    source_->subscribe(this);
+  } else {
+    read_tid_ = std::thread([this] {
+      Trace::threadName("read");
+      doReadInThread();
+    });
+  }
 }
 
-static int stream_has_enough_packets(AVStream *st, PacketQueue *queue) {
+static int stream_has_enough_packets(AVStream *st, const PacketQueue *queue, int min_frames, double min_duration) {
     return !st ||
            (st->disposition & AV_DISPOSITION_ATTACHED_PIC) ||
-           queue->has_enough_packets(st->time_base);
+           queue->has_enough_packets(st->time_base, min_frames, min_duration);
+}
+
+int64_t PlayBackContext::queuedBytes() const {
+  return (int64_t)audioPacketQueue_.size() + videoPacketQueue_.size() + subtitlePacketQueue_.size();
+}
+
+bool PlayBackContext::queuesFull() const {
+  if (infinite_buffer >= 1)
+    return false;
+
+  double duration = readAheadDuration_;
+  return queuedBytes() > max_queue_size ||
+          (stream_has_enough_packets(this->audio_st, &audioPacketQueue_, min_frames, duration) &&
+           stream_has_enough_packets(this->video_st, &videoPacketQueue_, min_frames, duration) &&
+           stream_has_enough_packets(this->subtitle_st, &subtitlePacketQueue_, min_frames, duration));
+}
+
+/* grow the read-ahead when a decoder ran dry although the queues had been
+ * filled before (the source cannot keep up), shrink it back towards
+ * buffer_duration when the byte budget is what stops reading */
+void PlayBackContext::updateReadAhead() {
+  if (!adaptive_buffer || infinite_buffer >= 1 || this->paused || eof_)
+    return;
+
+  auto now = av_gettime_relative();
+  if (now - readAheadAdjustTime_ < READ_AHEAD_ADJUST_INTERVAL)
+    return;
+
+  bool starved = (this->video_st && !(this->video_st->disposition & AV_DISPOSITION_ATTACHED_PIC) && videoPacketQueue_.empty()) ||
+                  (this->audio_st && audioPacketQueue_.empty());
+
+  double duration = readAheadDuration_;
+  if (starved && readAheadPrimed_ && duration < max_buffer_duration) {
+    duration = FFMIN(max_buffer_duration, duration * READ_AHEAD_GROW);
+    readAheadAdjustTime_ = now;
+    readAheadPrimed_ = false;
+    av_log(NULL, AV_LOG_VERBOSE, "source underrun, read-ahead raised to %0.2fs\n", duration);
+  } else if (queuedBytes() > max_queue_size && duration > buffer_duration) {
+    duration = FFMAX(buffer_duration, duration * READ_AHEAD_SHRINK);
+    readAheadAdjustTime_ = now;
+    av_log(NULL, AV_LOG_VERBOSE, "queue budget reached, read-ahead lowered to %0.2fs\n", duration);
+  }
+  readAheadDuration_ = duration;
 }
 
 void PlayBackContext::doReadInThread() {
@@ -2041,9 +2919,14 @@ void PlayBackContext::doReadInThread() {
       continue;
     }
 
-    if (seekMethod_ == SEEK_METHOD_POS) {
+    takeSeekRequest();
+
+    if (seekMethod_ == SEEK_METHOD_POS || seekMethod_ == SEEK_METHOD_KEYFRAME) {
       int64_t seek_target = this->seek_pos;
-      syncVideoPts_ = av_rescale_q(seek_target, AVRational{ 1, AV_TIME_BASE }, video_time_base_);
+      if (seekMethod_ == SEEK_METHOD_POS)
+        syncVideoPts_ = av_rescale_q(seek_target, AVRational{ 1, AV_TIME_BASE }, video_time_base_);
+      else
+        syncVideoPts_ = -1;
 
       if (rewindMode()) {
         // change the seek mode to rewind seek
@@ -2060,6 +2943,10 @@ void PlayBackContext::doReadInThread() {
         } else {
           newSerial();
           this->extclk.set_clock(seek_target / (double)AV_TIME_BASE, 0);
+          if (seekMethod_ == SEEK_METHOD_KEYFRAME) {
+            scrubTarget_ = seek_target;
+            scrubRefineTime_ = av_gettime_relative() + SCRUB_REFINE_DELAY;
+          }
         }
       }
     } else if (seekMethod_ == SEEK_METHOD_BYTES) {
@@ -2084,6 +2971,18 @@ void PlayBackContext::doReadInThread() {
       }
     }
 
+    if (seekMethod_ == SEEK_METHOD_KEYFRAME) {
+      // shown from the key frame on, no catch-up
+      seekMethod_ = SEEK_METHOD_NONE;
+      this->queue_attachments_req = 1;
+      this->eof_ = false;
+
+      if (this->paused) {
+        stream_toggle_pause();
+        stepping_ = true;
+      }
+    }
+
     if (seekMethod_ == SEEK_METHOD_POS || seekMethod_ == SEEK_METHOD_BYTES) {
       seekMethod_ = SEEK_METHOD_NONE;
       this->queue_attachments_req = 1;
@@ -2094,7 +2993,14 @@ void PlayBackContext::doReadInThread() {
       bool v_syned = video_stream < 0;
       bool a_syned = audio_stream < 0;
       while (!a_syned || !v_syned) {
-        ret = av_read_frame(ic, pkt);
+        // superseded, the newer seek flushes what was read here
+        if (abort_reading_ || seekMailbox_.pending())
+          break;
+
+        {
+          TRACE_SCOPE("av_read_frame");
+          ret = av_read_frame(ic, pkt);
+        }
         if (ret < 0) {
           break;
         }
@@ -2137,7 +3043,10 @@ void PlayBackContext::doReadInThread() {
 
         // till we got first video frame
         for (;;) {
-          ret = av_read_frame(ic, pkt);
+          {
+            TRACE_SCOPE("av_read_frame");
+            ret = av_read_frame(ic, pkt);
+          }
           if (ret < 0) {
             break;
           }
@@ -2162,7 +3071,10 @@ void PlayBackContext::doReadInThread() {
       } else {
         // till we got first video frame
         for (;;) {
-          ret = av_read_frame(ic, pkt);
+          {
+            TRACE_SCOPE("av_read_frame");
+            ret = av_read_frame(ic, pkt);
+          }
           if (ret < 0) {
             break;
           }
@@ -2191,12 +3103,11 @@ void PlayBackContext::doReadInThread() {
       this->queue_attachments_req = 0;
     }
 
+    updateReadAhead();
+
     /* if the queue are full, no need to read more */
-    if (infinite_buffer<1 &&
-              (audioPacketQueue_.size() + videoPacketQueue_.size() + subtitlePacketQueue_.size() > MAX_QUEUE_SIZE
-            || (stream_has_enough_packets(this->audio_st, &audioPacketQueue_) &&
-                stream_has_enough_packets(this->video_st, &videoPacketQueue_) &&
-                stream_has_enough_packets(this->subtitle_st, &subtitlePacketQueue_)))) {
+    if (queuesFull()) {
+            readAheadPrimed_ = true;
             /* wait 10 ms */
             std::unique_lock<std::mutex> lk(this->wait_mtx);
             continue_read_thread_.wait_for(lk, 10ms);
@@ -2210,7 +3121,10 @@ void PlayBackContext::doReadInThread() {
           goto fail;
     }
   
-    ret = av_read_frame(ic, pkt);
+    {
+      TRACE_SCOPE("av_read_frame");
+      ret = av_read_frame(ic, pkt);
+    }
     if (ret < 0) {
             if ((ret == AVERROR_EOF || avio_feof(ic->pb)) && !eof_) {
                 if (this->video_stream >= 0)
@@ -2231,6 +3145,7 @@ void PlayBackContext::doReadInThread() {
           continue;
     } else {
             this->eof_ = false;
+            markStartup(STARTUP_FIRST_PACKET);
     }
         
     /* check if packet is in play range specified by user, then queue, otherwise discard */
@@ -2287,7 +3202,7 @@ void PlayBackContext::doReadInThread() {
     } else if (pkt->stream_index == this->subtitle_stream && pkt_in_play_range) {
             subtitlePacketQueue_.put(pkt);
         }  else if (pkt->stream_index == this->data_stream) {
-          dataPacketQueue_.put(pkt);
+          pushPacket(pkt);
         } else {
             av_packet_unref(pkt);
     }
@@ -2301,6 +3216,120 @@ fail:
   }
 }
 
+/* read thread of a shared source subscriber: packets are pushed by the
+ * source, this only forwards seeks and watches for the end */
+void PlayBackContext::doFollowSourceInThread() {
+  int ret = 0;
+
+  while (!abort_reading_) {
+    takeSeekRequest();
+
+    if (seekMethod_ == SEEK_METHOD_POS || seekMethod_ == SEEK_METHOD_BYTES || seekMethod_ == SEEK_METHOD_KEYFRAME) {
+      source_->requestSeek(this->seek_pos, this->seek_rel, seekMethod_ == SEEK_METHOD_BYTES);
+      seekMethod_ = SEEK_METHOD_NONE;
+    } else if (seekMethod_ != SEEK_METHOD_NONE) {
+      // rewinding needs a demuxer of its own
+      seekMethod_ = SEEK_METHOD_NONE;
+    }
+
+    if (this->queue_attachments_req) {
+      if (this->video_st && this->video_st->disposition & AV_DISPOSITION_ATTACHED_PIC) {
+                AVPacket copy;
+                if ((ret = av_packet_ref(&copy, &this->video_st->attached_pic)) < 0)
+                    break;
+        videoPacketQueue_.put(&copy);
+        videoPacketQueue_.put_nullpacket(this->video_stream);
+      }
+      this->queue_attachments_req = 0;
+    }
+
+    updateReadAhead();
+    if (queuesFull())
+      readAheadPrimed_ = true;
+
+    if (source_->failed())
+      break;
+
+    if (!this->paused &&
+            (!this->audio_st || (audioDecoder_.finished() && sampleQueue_.nb_remaining() == 0)) &&
+            (!this->video_st || (videoDecoder_.finished() && pictureQueue_.nb_remaining() == 0))) {
+      break;
+    }
+
+    std::unique_lock<std::mutex> lk(this->wait_mtx);
+    continue_read_thread_.wait_for(lk, 10ms);
+  }
+
+  MediaEvent ev;
+  ev.event = MEDIA_CMD_QUIT;
+  evq_.set(&ev);
+}
+
+bool PlayBackContext::playsStream(int stream_index) const {
+  return stream_index == this->audio_stream ||
+          stream_index == this->video_stream ||
+          stream_index == this->subtitle_stream ||
+          stream_index == this->data_stream;
+}
+
+int PlayBackContext::pushSourcePacket(AVPacket *pkt, bool helper) {
+  this->eof_ = false;
+  markStartup(STARTUP_FIRST_PACKET);
+
+  if (pkt->stream_index == this->video_stream) {
+    if (this->video_st->disposition & AV_DISPOSITION_ATTACHED_PIC) {
+      av_packet_unref(pkt);
+      return 0;
+    }
+
+    if (this->drop_frame_mode) {
+      // restore when key frame
+      if (pkt->flags & AV_PKT_FLAG_KEY) {
+        this->drop_frame_mode = false;
+      } else {
+        av_packet_unref(pkt);
+        return 0;
+      }
+    }
+  }
+
+  return pushPacket(pkt, helper ? SERIAL_HELPER_PACKET : -1);
+}
+
+void PlayBackContext::onSourceSeeked(int64_t target, bool by_bytes) {
+  newSerial();
+  if (by_bytes) {
+    this->extclk.set_clock(NAN, 0);
+  } else {
+    syncVideoPts_ = av_rescale_q(target, AVRational{ 1, AV_TIME_BASE }, video_time_base_);
+    this->extclk.set_clock(target / (double)AV_TIME_BASE, 0);
+  }
+
+  this->queue_attachments_req = 1;
+  this->eof_ = false;
+
+  if (this->paused) {
+    stream_toggle_pause();
+    stepping_ = true;
+  }
+  continue_read_thread_.notify_one();
+}
+
+void PlayBackContext::onSourceEof() {
+  if (eof_)
+    return;
+
+  if (this->video_stream >= 0)
+    videoPacketQueue_.put_nullpacket(this->video_stream);
+  if (this->audio_stream >= 0)
+    audioPacketQueue_.put_nullpacket(this->audio_stream);
+  if (this->subtitle_stream >= 0)
+    subtitlePacketQueue_.put_nullpacket(this->subtitle_stream);
+  if (this->data_stream >= 0)
+    dataPacketQueue_.put_nullpacket(this->data_stream);
+  eof_ = true;
+}
+
 struct AVCodecContextRelease {
   AVCodecContext *avctx_;
   AVCodecContextRelease(AVCodecContext *avctx):avctx_(avctx)  {}
@@ -2386,7 +3415,9 @@ void PlayBackContext::streamComponentOpen(int stream_index) {
   }
 
   this->eof_ = false;
-  ic->streams[stream_index]->discard = AVDISCARD_DEFAULT;
+  // a shared source updates discard on subscribe
+  if (!source_)
+    ic->streams[stream_index]->discard = AVDISCARD_DEFAULT;
 
   switch (avctx->codec_type) {
     case AVMEDIA_TYPE_AUDIO:
@@ -2454,9 +3485,25 @@ void PlayBackContext::streamComponentOpen(int stream_index) {
         video_frame_rate_ = av_guess_frame_rate(this->ic, this->video_st, NULL);
         frame_duration_ = (video_frame_rate_.num && video_frame_rate_.den ? av_q2d(AVRational{video_frame_rate_.den, video_frame_rate_.num}) : 0);
         video_time_base_ = this->video_st->time_base;
+        video_codec_id_ = this->video_st->codecpar->codec_id;
+        video_nal_length_size_ = detection_nal_length_size(video_codec_id_,
+            this->video_st->codecpar->extradata, this->video_st->codecpar->extradata_size);
 
         videoPacketQueue_.start();
 
+        videoDecoder_.helper_skip_loop_filter = seek_skip_loop_filter;
+#ifdef BUILD_WITH_VIDEO_FILTER
+        // finished by the filter stage, see startVideoFilterThread
+        videoDecoder_.defer_finish = true;
+#endif
+        // bands per picture, the threads are shared by all players
+        yuv_ctx_.threads = convert_threads ? convert_threads :
+            FFMIN((int)std::thread::hardware_concurrency(), MAX_CONVERT_THREADS);
+        yuv_ctx_.target_fmt = out_pix_fmts[0];
+        decode_yuv_ctx_.target_fmt = out_pix_fmts[0];
+        decode_yuv_ctx_.threads = yuv_ctx_.threads;
+        decode_yuv_ctx_.dst_width = convert_width;
+        decode_yuv_ctx_.dst_height = convert_height;
         videoDecoder_.init(avctx);
         ctxLk.giveup();
 
@@ -2493,6 +3540,10 @@ void PlayBackContext::streamClose() {
 		read_tid_.join();
 	}
 
+  // no more packets from the shared source
+  if (source_)
+    source_->unsubscribe(this);
+
   /* close each stream */
   if (this->audio_stream >= 0)
         streamComponentClose(this->audio_stream);
@@ -2504,7 +3555,14 @@ void PlayBackContext::streamClose() {
   // close anyway
   stopDataDecode();
 
-  avformat_close_input(&ic);
+  if (source_) {
+    ic = nullptr;
+    source_.reset();
+  } else {
+    avformat_close_input(&ic);
+    // custom pb is not closed with the format context
+    input_.reset();
+  }
 
 #ifdef BUILD_WITH_AUDIO_FILTER
   avfilter_graph_free(&this->agraph);
@@ -2538,6 +3596,10 @@ void PlayBackContext::streamComponentClose(int stream_index) {
     case AVMEDIA_TYPE_VIDEO:
       videoPacketQueue_.abort();
       pictureQueue_.abort();
+#ifdef BUILD_WITH_VIDEO_FILTER
+      // releases a decoder waiting to hand over a frame
+      stopVideoFilterThread();
+#endif
       videoDecoder_.abort();
       videoDecoder_.destroy();
       break;
@@ -2552,7 +3614,8 @@ void PlayBackContext::streamComponentClose(int stream_index) {
       break;
   }
 
-  ic->streams[stream_index]->discard = AVDISCARD_ALL;
+  if (!source_)
+    ic->streams[stream_index]->discard = AVDISCARD_ALL;
   switch (codecpar->codec_type) {
     case AVMEDIA_TYPE_AUDIO:
         this->audio_st = NULL;
@@ -2619,7 +3682,8 @@ fail:
     return ret;
 }
 
-int PlayBackContext::configure_video_filters(AVFilterGraph *graph, const char *vfilters, AVFrame *frame)
+int PlayBackContext::configure_video_filters(AVFilterGraph *graph, const char *vfilters, int width, int height, int format,
+                                             AVFilterContext **in, AVFilterContext **out)
 {
     enum AVPixelFormat pix_fmts[2];
     char sws_flags_str[512] = "";
@@ -2648,7 +3712,7 @@ int PlayBackContext::configure_video_filters(AVFilterGraph *graph, const char *v
 
     snprintf(buffersrc_args, sizeof(buffersrc_args),
              "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:pixel_aspect=%d/%d",
-             frame->width, frame->height, frame->format,
+             width, height, format,
              this->video_st->time_base.num, this->video_st->time_base.den,
              codecpar->sample_aspect_ratio.num, FFMAX(codecpar->sample_aspect_ratio.den, 1));
     if (fr.num && fr.den)
@@ -2692,13 +3756,34 @@ int PlayBackContext::configure_video_filters(AVFilterGraph *graph, const char *v
     if ((ret = configure_filtergraph(graph, vfilters, filt_src, last_filter)) < 0)
         goto fail;
 
-    this->in_video_filter  = filt_src;
-    this->out_video_filter = filt_out;
+    *in  = filt_src;
+    *out = filt_out;
 
 fail:
     return ret;
 }
 
+#ifdef BUILD_WITH_VIDEO_FILTER
+/* reads only what stays put while the stream is open, so a replacement may
+ * be built off the decoder thread */
+std::unique_ptr<VideoFilter> PlayBackContext::buildVideoFilter(int idx, int width, int height, int format) {
+  std::unique_ptr<VideoFilter> filter(new VideoFilter);
+  filter->width = width;
+  filter->height = height;
+  filter->format = format;
+  filter->idx = idx;
+
+  if (!(filter->graph = avfilter_graph_alloc()))
+    return nullptr;
+  filter->graph->nb_threads = filter_nbthreads;
+
+  const char *vfilters = idx < (int)vfilters_list.size() ? vfilters_list[idx].c_str() : nullptr;
+  if (configure_video_filters(filter->graph, vfilters, width, height, format, &filter->in, &filter->out) < 0)
+    return nullptr;
+  return filter;
+}
+#endif
+
 void PlayBackContext::configureAudioFilters(bool force_output_format)
 {
     static const enum AVSampleFormat sample_fmts[] = { AV_SAMPLE_FMT_S16, AV_SAMPLE_FMT_NONE };
@@ -2851,6 +3936,7 @@ void PlayBackContext::sdl_audio_callback(void *opaque, Uint8 *stream, int len)
 {
     PlayBackContext *is = (PlayBackContext*)opaque;
     int audio_size, len1;
+    TRACE_SCOPE("sdl_audio_callback");
 
     is->audio_callback_time = av_gettime_relative();
 
@@ -2859,10 +3945,13 @@ void PlayBackContext::sdl_audio_callback(void *opaque, Uint8 *stream, int len)
            audio_size = is->audio_decode_frame();
            if (audio_size < 0) {
                 /* if error, just output silence */
+               if (!is->paused)
+                 is->audioUnderruns_++;
                is->audio_buf = NULL;
                is->audio_buf_size = SDL_AUDIO_MIN_BUFFER_SIZE / is->audio_tgt.frame_size * is->audio_tgt.frame_size;
            } else {
                is->audio_buf_size = audio_size;
+               is->markStartup(STARTUP_FIRST_AUDIO);
            }
            is->audio_buf_index = 0;
         }
@@ -3096,6 +4185,8 @@ double PlayBackContext::get_master_clock() const
 
 void PlayBackContext::onPacketDrained() {
   continue_read_thread_.notify_one();
+  if (source_)
+    source_->wakeup();
 }
 
 static inline
@@ -3111,13 +4202,32 @@ int cmp_audio_fmts(enum AVSampleFormat fmt1, int64_t channel_count1,
 
 int PlayBackContext::queuePicture(AVFrame *src_frame, double pts, double duration, int64_t pos, int serial)
 {
+    TRACE_SCOPE("queuePicture");
     Frame *vp;
 
     if (serial == SERIAL_HELPER_PACKET) {
+      helperFramesDiscarded_++;
       av_frame_unref(src_frame);
       return 0;
     }
 
+    // presentation then only hands the picture over
+    if (convert_in_decoder && onIYUVDisplay &&
+        (!outputAccepts(src_frame->format) ||
+         (convert_width && (src_frame->width != convert_width || src_frame->height != convert_height)))) {
+      AVFrame *converted = av_frame_alloc();
+      int64_t begin = av_gettime_relative();
+      if (converted && decode_yuv_ctx_.convert(src_frame, converted) >= 0) {
+        av_frame_unref(src_frame);
+        av_frame_move_ref(src_frame, converted);
+      }
+      addConvertTime(av_gettime_relative() - begin);
+      av_frame_free(&converted);
+    }
+
+    markStartup(STARTUP_FIRST_FRAME);
+    framesDecoded_++;
+
 #if defined(DEBUG_SYNC)
     printf("frame_type=%c pts=%0.3f\n",
            av_get_picture_type_char(src_frame->pict_type), pts);
@@ -3137,6 +4247,8 @@ int PlayBackContext::queuePicture(AVFrame *src_frame, double pts, double duratio
   vp->duration = duration;
   vp->pos = pos;
   vp->serial = serial;
+  vp->demuxed = src_frame->reordered_opaque > 0 ? src_frame->reordered_opaque : 0;
+  vp->decoded = av_gettime_relative();
 
   av_frame_move_ref(vp->frame, src_frame);
   pictureQueue_.push();
@@ -3144,34 +4256,44 @@ int PlayBackContext::queuePicture(AVFrame *src_frame, double pts, double duratio
 }
 
 void PlayBackContext::startVideoDecodeThread() {
+#ifdef BUILD_WITH_VIDEO_FILTER
+  startVideoFilterThread();
+#endif
 
   videoDecoder_.start([this](Decoder* decoder, int *pfinished) {
+    Trace::threadName("video decoder");
     int ret;
     AVFrame *frame = av_frame_alloc();
     int pkt_serial = -1;
 
+#ifndef BUILD_WITH_VIDEO_FILTER
     double pts;
     double duration;
 
     AVRational tb = this->video_st->time_base;
     AVRational frame_rate = av_guess_frame_rate(ic, this->video_st, NULL);
-
-#ifdef BUILD_WITH_VIDEO_FILTER
-    AVFilterGraph *graph = NULL;
-    AVFilterContext *filt_out = NULL, *filt_in = NULL;
-    int last_w = 0;
-    int last_h = 0;
-    enum AVPixelFormat last_format = (AVPixelFormat)-2;
-    int last_serial = -1;
-    int last_vfilter_idx = 0;
 #endif
 
     for (;;) {
       ret = getVideoFrame(frame, pkt_serial);
       if (ret < 0)
         goto the_end;
-      if (!ret)
+      if (!ret) {
+#ifdef BUILD_WITH_VIDEO_FILTER
+        // the end of the stream follows the last frames through the filters
+        if (decoder->takeDrained()) {
+          if (rewindMode() || pkt_serial == SERIAL_HELPER_PACKET) {
+            decoder->finish(pkt_serial);
+          } else {
+            SimpleFrame eof;
+            eof.serial = pkt_serial;
+            if (!videoFilterQueue_.put(std::move(eof)))
+              goto the_end;
+          }
+        }
+#endif
         continue;
+      }
 
       if (rewindMode()) {
         ret = onVideoFrameDecodedReversed(frame, pkt_serial);
@@ -3179,97 +4301,202 @@ void PlayBackContext::startVideoDecodeThread() {
       }
 
 #ifdef BUILD_WITH_VIDEO_FILTER
-      if (   last_w != frame->width
-            || last_h != frame->height
-            || last_format != frame->format
-            || last_serial != pkt_serial
-            || last_vfilter_idx != this->vfilter_idx) {
-        av_log(NULL, AV_LOG_DEBUG,
-                   "Video frame changed from size:%dx%d format:%s serial:%d to size:%dx%d format:%s serial:%d\n",
-                   last_w, last_h,
-                   (const char *)av_x_if_null(av_get_pix_fmt_name(last_format), "none"), last_serial,
-                   frame->width, frame->height,
-                   (const char *)av_x_if_null(av_get_pix_fmt_name((AVPixelFormat)frame->format), "none"), pkt_serial);
-        avfilter_graph_free(&graph);
-        graph = avfilter_graph_alloc();
-        if (!graph) {
-          ret = AVERROR(ENOMEM);
-          goto the_end;
-        }
-        graph->nb_threads = filter_nbthreads;
-        if ((ret = configure_video_filters(graph, vfilters_list.size() > this->vfilter_idx ? vfilters_list[this->vfilter_idx].c_str() : nullptr, frame)) < 0) {
-          MediaEvent ev;
-          ev.event = MEDIA_CMD_QUIT;
-          evq_.set(&ev);
-          goto the_end;
-        }
-        filt_in  = this->in_video_filter;
-        filt_out = this->out_video_filter;
-        last_w = frame->width;
-        last_h = frame->height;
-        last_format = (AVPixelFormat)frame->format;
-        last_serial = pkt_serial;
-        last_vfilter_idx = this->vfilter_idx;
-        frame_rate = av_buffersink_get_frame_rate(filt_out);
+      // only counted, they never reach the filters
+      if (pkt_serial == SERIAL_HELPER_PACKET) {
+        queuePicture(frame, NAN, 0, -1, pkt_serial);
+        continue;
       }
 
-      ret = av_buffersrc_add_frame(filt_in, frame);
+      // filtered on a stage of its own while the next picture decodes
+      if (!videoFilterQueue_.put(SimpleFrame(frame, pkt_serial, 0, 0)))
+        goto the_end;
+#else
+      duration = (frame_rate.num && frame_rate.den ? av_q2d(AVRational{frame_rate.den, frame_rate.num}) : 0);
+      pts = (frame->pts == AV_NOPTS_VALUE) ? NAN : frame->pts * av_q2d(tb);
+      ret = queuePicture(frame, pts, duration, frame->pkt_pos, pkt_serial);
+      av_frame_unref(frame);
+
       if (ret < 0)
         goto the_end;
+#endif
+    }
+the_end:
+    av_frame_free(&frame);
+  });
+}
 
-      while (ret >= 0) {
+#ifdef BUILD_WITH_VIDEO_FILTER
+/* the stage between the video decoder and the picture queue */
+void PlayBackContext::startVideoFilterThread() {
+  stopVideoFilterThread();
+
+  videoFilterQueue_.start();
+  videoFilterTid_ = std::thread([this] {
+    Trace::threadName("video filter");
+    AVRational tb = this->video_st->time_base;
+    AVRational frame_rate = av_guess_frame_rate(ic, this->video_st, NULL);
+    std::unique_ptr<VideoFilter> filter;
+    int filter_serial = -1;    // of the frames the graph has seen
+    std::future<std::unique_ptr<VideoFilter>> next_filter;   // another -vf entry, being built
+    // a fresh copy of the current graph, the next seek swaps it in
+    std::unique_ptr<VideoFilter> spare;
+    std::future<std::unique_ptr<VideoFilter>> spare_build;
+    bool spare_wanted = false;
+    SimpleFrame input;
+    int ret = 0;
+
+    auto build = [this](int idx, int width, int height, int format) {
+      return std::async(std::launch::async, [this, idx, width, height, format] {
+        Trace::threadName("video filter build");
+        return buildVideoFilter(idx, width, height, format);
+      });
+    };
+    auto use = [&](std::unique_ptr<VideoFilter> built) {
+      filter = std::move(built);
+      frame_rate = av_buffersink_get_frame_rate(filter->out);
+      spare_wanted = true;
+    };
+
+    // queues what the graph has ready, its EOF finishes the decoder
+    AVFrame *out = av_frame_alloc();
+    auto drain = [&](int serial) {
+      int ret;
+      for (;;) {
         this->frame_last_returned_time = av_gettime_relative() / 1000000.0;
 
-        ret = av_buffersink_get_frame_flags(filt_out, frame, 0);
-        if (ret < 0) {
-          if (ret == AVERROR_EOF)
-            *pfinished = pkt_serial;
-          ret = 0;
+        ret = av_buffersink_get_frame_flags(filter->out, out, 0);
+        if (ret < 0)
           break;
-        }
 
         this->frame_last_filter_delay = av_gettime_relative() / 1000000.0 - this->frame_last_returned_time;
         if (fabs(this->frame_last_filter_delay) > AV_NOSYNC_THRESHOLD / 10.0)
           this->frame_last_filter_delay = 0;
-        tb = av_buffersink_get_time_base(filt_out);
-#endif
-        duration = (frame_rate.num && frame_rate.den ? av_q2d(AVRational{frame_rate.den, frame_rate.num}) : 0);
-        pts = (frame->pts == AV_NOPTS_VALUE) ? NAN : frame->pts * av_q2d(tb);
-        ret = queuePicture(frame, pts, duration, frame->pkt_pos, pkt_serial);
-        av_frame_unref(frame);
-#ifdef BUILD_WITH_VIDEO_FILTER
-        if (videoSerial_ != pkt_serial)
+        tb = av_buffersink_get_time_base(filter->out);
+
+        double duration = (frame_rate.num && frame_rate.den ? av_q2d(AVRational{frame_rate.den, frame_rate.num}) : 0);
+        double pts = (out->pts == AV_NOPTS_VALUE) ? NAN : out->pts * av_q2d(tb);
+        ret = queuePicture(out, pts, duration, out->pkt_pos, serial);
+        av_frame_unref(out);
+        if (ret < 0 || videoSerial_ != serial)
+          return ret;
+      }
+
+      if (ret == AVERROR_EOF) {
+        filter_serial = -1;   // takes no more frames
+        videoDecoder_.finish(serial);
+      }
+      return 0;
+    };
+
+    while (ret >= 0 && videoFilterQueue_.get(input)) {
+      TRACE_SCOPE("video filter");
+      AVFrame *frame = input.frame;
+      int serial = input.serial;
+
+      // decoded before a seek
+      if (serial != videoSerial_)
+        continue;
+
+      // the decoder drained, the frames the graph holds back come out now
+      if (!frame) {
+        if (filter && serial == filter_serial && av_buffersrc_add_frame(filter->in, NULL) >= 0)
+          ret = drain(serial);
+        else
+          videoDecoder_.finish(serial);
+        continue;
+      }
+
+      // filters keeping timestamp state (fps, framerate, setpts with N or T,
+      // minterpolate) must not see pts go back, a seek starts on a new graph
+      if (filter && serial != filter_serial) {
+        if (!spare && spare_build.valid())
+          spare = spare_build.get();
+        if (spare && spare->sameAs(*filter) && spare->accepts(frame))
+          use(std::move(spare));
+        else
+          filter.reset();
+        spare.reset();
+      }
+
+      // only a new input format rebuilds in place
+      if (!filter || !filter->accepts(frame)) {
+        av_log(NULL, AV_LOG_DEBUG,
+                   "Video frame changed from size:%dx%d format:%s to size:%dx%d format:%s\n",
+                   filter ? filter->width : 0, filter ? filter->height : 0,
+                   (const char *)av_x_if_null(av_get_pix_fmt_name(filter ? (AVPixelFormat)filter->format : AV_PIX_FMT_NONE), "none"),
+                   frame->width, frame->height,
+                   (const char *)av_x_if_null(av_get_pix_fmt_name((AVPixelFormat)frame->format), "none"));
+        auto built = buildVideoFilter(this->vfilter_idx, frame->width, frame->height, frame->format);
+        if (!built) {
+          MediaEvent ev;
+          ev.event = MEDIA_CMD_QUIT;
+          evq_.set(&ev);
           break;
+        }
+        use(std::move(built));
+      } else if (next_filter.valid()) {
+        // the old chain runs until the new one is ready; frames it holds are dropped
+        if (next_filter.wait_for(0s) == std::future_status::ready) {
+          auto built = next_filter.get();
+          if (built && built->accepts(frame)) {
+            use(std::move(built));
+          } else if (!built) {
+            av_log(NULL, AV_LOG_ERROR, "video filter %d failed, kept the current one\n", (int)this->vfilter_idx);
+            this->vfilter_idx = filter->idx;
+          }
+        }
+      } else if (filter->idx != this->vfilter_idx) {
+        next_filter = build(this->vfilter_idx, frame->width, frame->height, frame->format);
+      }
+      filter_serial = serial;
+      this->in_video_filter = filter->in;
+      this->out_video_filter = filter->out;
+
+      // built with the same code as the hot-swap, off this thread
+      if (spare_build.valid() && spare_build.wait_for(0s) == std::future_status::ready)
+        spare = spare_build.get();
+      if (spare_wanted && !spare_build.valid()) {
+        spare.reset();
+        spare_build = build(filter->idx, filter->width, filter->height, filter->format);
+        spare_wanted = false;
       }
-#endif
 
-      if (ret < 0)
-        goto the_end;
+      ret = av_buffersrc_add_frame(filter->in, frame);
+      if (ret >= 0)
+        ret = drain(serial);
     }
-the_end:
-#ifdef BUILD_WITH_VIDEO_FILTER
-    avfilter_graph_free(&graph);
-#endif
-    av_frame_free(&frame);
+
+    // the graphs go with the thread
+    this->in_video_filter = nullptr;
+    this->out_video_filter = nullptr;
+    av_frame_free(&out);
   });
 }
 
+void PlayBackContext::stopVideoFilterThread() {
+  videoFilterQueue_.abort();
+  if (videoFilterTid_.joinable())
+    videoFilterTid_.join();
+}
+#endif
+
 int PlayBackContext::getVideoFrame(AVFrame *frame, int& pkt_serial) {
   int got_picture;
 
   if ((got_picture = videoDecoder_.decodeFrame(
-        [this](AVMediaType, AVCodecID codec_id, AVPacket *pkt, int *serial) {
+        [this](AVMediaType, AVCodecID codec_id, AVPacket *pkt, int *serial, int64_t *pkt_time) {
           if (videoPacketQueue_.empty())
             onPacketDrained();
 
-          if (videoPacketQueue_.get(pkt, serial) < 0)
+          if (videoPacketQueue_.get(pkt, serial, pkt_time) < 0)
             return -1;
 
           if (videoPacketIsAddonData(codec_id, pkt)) {
-            // ai detection data embedded as sei packet
+            // ai detection data embedded as sei packet, keeps the serial
+            // of its picture
             AVPacket copy = { 0 };
             if (av_packet_ref(&copy, pkt) >= 0) {
-              dataPacketQueue_.put(&copy);
+              dataPacketQueue_.put(&copy, *serial);
             }
           }
 
@@ -3314,56 +4541,69 @@ int PlayBackContext::getVideoFrame(AVFrame *frame, int& pkt_serial) {
 
 void PlayBackContext::startAudioDecodeThread() {
   audioDecoder_.start([this](Decoder* decoder, int *pfinished) {
+    Trace::threadName("audio decoder");
     AVFrame *frame = av_frame_alloc();
     Frame *af;
     int pkt_serial = -1;
 #ifdef BUILD_WITH_AUDIO_FILTER
-    int last_serial = -1;
+    bool output_forced = false;   // sink set to the device format
     int64_t dec_channel_layout;
     int reconfigure;
 #endif
     int got_frame = 0;
     AVRational tb;
     int ret = 0;
+    std::unique_ptr<LoudnessNormalizer> normalizer;
+    int normalized_serial = -1;
 
     do {
       if ((got_frame = decoder->decodeFrame(
-        [this](AVMediaType, AVCodecID, AVPacket *pkt, int *serial) {
+        [this](AVMediaType, AVCodecID, AVPacket *pkt, int *serial, int64_t *pkt_time) {
           if (audioPacketQueue_.empty())
             onPacketDrained();
 
-          return audioPacketQueue_.get(pkt, serial);
+          return audioPacketQueue_.get(pkt, serial, pkt_time);
 
         }, frame, nullptr, pkt_serial)) < 0)
         goto the_end;
 
       if (got_frame) {
+        markStartup(STARTUP_FIRST_FRAME);
         tb = AVRational{1, frame->sample_rate};
 
+        // before the seek target, decoded only to prime the decoder
+        if (pkt_serial == SERIAL_HELPER_PACKET) {
+          helperFramesDiscarded_++;
+          av_frame_unref(frame);
+          continue;
+        }
+        int serial = pkt_serial;
+
 #ifdef BUILD_WITH_AUDIO_FILTER
         dec_channel_layout = get_valid_channel_layout(frame->channel_layout, frame->channels);
 
+        // seeks keep the graph, only a new input format rebuilds it
         reconfigure =
                     cmp_audio_fmts(this->audio_filter_src.fmt, this->audio_filter_src.channels,
                                    (AVSampleFormat)frame->format, frame->channels)    ||
                     this->audio_filter_src.channel_layout != dec_channel_layout ||
                     this->audio_filter_src.freq           != frame->sample_rate ||
-                    pkt_serial               != last_serial;
+                    !output_forced;
 
         if (reconfigure) {
                     char buf1[1024], buf2[1024];
                     av_get_channel_layout_string(buf1, sizeof(buf1), -1, this->audio_filter_src.channel_layout);
                     av_get_channel_layout_string(buf2, sizeof(buf2), -1, dec_channel_layout);
                     av_log(NULL, AV_LOG_DEBUG,
-                           "Audio frame changed from rate:%d ch:%d fmt:%s layout:%s serial:%d to rate:%d ch:%d fmt:%s layout:%s serial:%d\n",
-                           this->audio_filter_src.freq, this->audio_filter_src.channels, av_get_sample_fmt_name(this->audio_filter_src.fmt), buf1, last_serial,
-                           frame->sample_rate, frame->channels, av_get_sample_fmt_name((AVSampleFormat)frame->format), buf2, pkt_serial);
+                           "Audio frame changed from rate:%d ch:%d fmt:%s layout:%s to rate:%d ch:%d fmt:%s layout:%s\n",
+                           this->audio_filter_src.freq, this->audio_filter_src.channels, av_get_sample_fmt_name(this->audio_filter_src.fmt), buf1,
+                           frame->sample_rate, frame->channels, av_get_sample_fmt_name((AVSampleFormat)frame->format), buf2);
 
                     this->audio_filter_src.fmt            = (AVSampleFormat)frame->format;
                     this->audio_filter_src.channels       = frame->channels;
                     this->audio_filter_src.channel_layout = dec_channel_layout;
                     this->audio_filter_src.freq           = frame->sample_rate;
-                    last_serial                         = pkt_serial;
+                    output_forced                       = true;
                     try {
                       configureAudioFilters(true);
                     } catch (exception& e) {
@@ -3371,25 +4611,49 @@ void PlayBackContext::startAudioDecodeThread() {
                     }
         }
 
+        frame->opaque = (void*)(intptr_t)pkt_serial;
         if ((ret = av_buffersrc_add_frame(this->in_audio_filter, frame)) < 0)
           goto the_end;
 
         while ((ret = av_buffersink_get_frame_flags(this->out_audio_filter, frame, 0)) >= 0) {
           tb = av_buffersink_get_time_base(this->out_audio_filter);
+
+          // held by the graph from before a seek
+          serial = (int)(intptr_t)frame->opaque;
+          if (serial != audioSerial_) {
+            av_frame_unref(frame);
+            continue;
+          }
 #endif
+          double latency = 0;
+          if (loudnorm && frame->format == AV_SAMPLE_FMT_S16) {
+            TRACE_SCOPE("loudnorm");
+            if (!normalizer || !normalizer->accepts(frame->sample_rate, frame->channels))
+              normalizer.reset(new LoudnessNormalizer(frame->sample_rate, frame->channels, loudnorm_lookahead));
+            else if (serial != normalized_serial)
+              normalizer->flush();
+            normalized_serial = serial;
+
+            normalizer->setTarget(loudnorm_target);
+            normalizer->process((int16_t *)frame->data[0], frame->nb_samples);
+            latency = normalizer->latency();
+          } else if (normalizer) {
+            normalizer.reset();
+          }
+
           if (!(af = sampleQueue_.peek_writable()))
             goto the_end;
 
-          af->pts = (frame->pts == AV_NOPTS_VALUE) ? NAN : frame->pts * av_q2d(tb);
+          af->pts = (frame->pts == AV_NOPTS_VALUE) ? NAN : frame->pts * av_q2d(tb) - latency;
           af->pos = frame->pkt_pos;
-          af->serial = pkt_serial;
+          af->serial = serial;
           af->duration = av_q2d(AVRational{frame->nb_samples, frame->sample_rate});
 
           av_frame_move_ref(af->frame, frame);
           sampleQueue_.push();
 
 #ifdef BUILD_WITH_AUDIO_FILTER
-          if (audioSerial_ != pkt_serial)
+          if (audioSerial_ != serial)
             break;
         }
         if (ret == AVERROR_EOF)
@@ -3409,6 +4673,7 @@ the_end:
 
 void PlayBackContext::startSubtitleDecodeThread() {
   subtitleDecoder_.start([this](Decoder* decoder, int *pfinished) {
+    Trace::threadName("subtitle decoder");
     Frame *sp;
     int got_subtitle;
     double pts;
@@ -3419,17 +4684,17 @@ void PlayBackContext::startSubtitleDecodeThread() {
         return;
 
       if ((got_subtitle = decoder->decodeFrame(
-        [this](AVMediaType, AVCodecID codec_id, AVPacket *pkt, int *serial) {
+        [this](AVMediaType, AVCodecID codec_id, AVPacket *pkt, int *serial, int64_t *pkt_time) {
           if (subtitlePacketQueue_.empty())
             onPacketDrained();
 
-          return subtitlePacketQueue_.get(pkt, serial);
+          return subtitlePacketQueue_.get(pkt, serial, pkt_time);
         }, nullptr, &sp->sub, pkt_serial)) < 0)
         break;
 
       pts = 0;
 
-      if (got_subtitle && sp->sub.format == 0) {
+      if (got_subtitle) {
             if (sp->sub.pts != AV_NOPTS_VALUE)
                 pts = sp->sub.pts / (double)AV_TIME_BASE;
             sp->pts = pts;
@@ -3440,8 +4705,6 @@ void PlayBackContext::startSubtitleDecodeThread() {
 
             /* now we can update the picture count */
             subtitleQueue_.push();
-      } else if (got_subtitle) {
-            avsubtitle_free(&sp->sub);
       }
     }
   });
@@ -3465,6 +4728,7 @@ void PlayBackContext::adjustExternalClockSpeed() {
 }
 
 void PlayBackContext::video_refresh(double *remaining_time) {
+  TRACE_SCOPE("video_refresh");
   double time;
 
 retry:
@@ -3545,6 +4809,21 @@ retry:
       }
     }
 
+    /* take down subtitles that ended or were superseded */
+    if (this->subtitle_st) {
+      while (subtitleQueue_.nb_remaining() > 0) {
+        Frame *sp = subtitleQueue_.peek();
+        Frame *sp2 = subtitleQueue_.nb_remaining() > 1 ? subtitleQueue_.peek_next() : nullptr;
+
+        if (sp->serial != subtitleSerial_
+            || (vidclk.pts > (sp->pts + ((float) sp->sub.end_display_time / 1000)))
+            || (sp2 && vidclk.pts > (sp2->pts + ((float) sp2->sub.start_display_time / 1000))))
+          subtitleQueue_.next();
+        else
+          break;
+      }
+    }
+
     pictureQueue_.next();
     force_refresh_ = true;
 
@@ -3553,6 +4832,10 @@ retry:
   }
 }
 
+bool PlayBackContext::outputAccepts(int format) const {
+  return std::find(out_pix_fmts.begin(), out_pix_fmts.end(), (AVPixelFormat)format) != out_pix_fmts.end();
+}
+
 int64_t PlayBackContext::ptsToFrameId(double pts) const {
   return  static_cast<int64_t>(pts / (frame_duration_ == 0 ? 60.0 : frame_duration_));
 }
@@ -3561,6 +4844,53 @@ double PlayBackContext::frameIdToPts(int64_t id) const {
   return id * (frame_duration_ == 0 ? 60.0 : frame_duration_);
 }
 
+/* bitmaps to premultiplied rgba through a premultiplied palette, once per
+ * subtitle event */
+static shared_ptr<const SubtitleOverlay> rasterize_subtitle(const Frame *sp) {
+  auto overlay = make_shared<SubtitleOverlay>();
+  overlay->pts = sp->pts + sp->sub.start_display_time / 1000.0;
+  overlay->end = sp->sub.end_display_time == UINT32_MAX ? NAN : sp->pts + sp->sub.end_display_time / 1000.0;
+  overlay->width = sp->width;
+  overlay->height = sp->height;
+
+  for (unsigned i = 0; i < sp->sub.num_rects; i++) {
+    const AVSubtitleRect *sub_rect = sp->sub.rects[i];
+    SubtitleOverlay::Rect rect;
+    rect.x = sub_rect->x;
+    rect.y = sub_rect->y;
+    rect.w = sub_rect->w;
+    rect.h = sub_rect->h;
+
+    if (sub_rect->type == SUBTITLE_BITMAP) {
+      uint8_t palette[256][4] = { { 0 } };
+      const uint32_t *src_palette = (const uint32_t *)sub_rect->data[1];
+      for (int c = 0; c < FFMIN(sub_rect->nb_colors, 256); c++) {
+        uint32_t argb = src_palette[c];
+        unsigned a = argb >> 24;
+        palette[c][0] = ((argb >> 16) & 0xff) * a / 255;
+        palette[c][1] = ((argb >> 8) & 0xff) * a / 255;
+        palette[c][2] = (argb & 0xff) * a / 255;
+        palette[c][3] = a;
+      }
+
+      rect.rgba.resize((size_t)rect.w * rect.h * 4);
+      uint8_t *dst = rect.rgba.data();
+      for (int y = 0; y < rect.h; y++) {
+        const uint8_t *src = sub_rect->data[0] + y * sub_rect->linesize[0];
+        for (int x = 0; x < rect.w; x++, dst += 4)
+          memcpy(dst, palette[src[x]], 4);
+      }
+    } else {
+      if (sub_rect->text)
+        rect.text = sub_rect->text;
+      if (sub_rect->ass)
+        rect.ass = sub_rect->ass;
+    }
+    overlay->rects.push_back(std::move(rect));
+  }
+  return overlay;
+}
+
 void PlayBackContext::video_image_display()
 {
   Frame *sp = nullptr;
@@ -3568,15 +4898,39 @@ void PlayBackContext::video_image_display()
 	if (!vp->uploaded) {
     if (onIYUVDisplay) {
       auto frame = vp->frame;
-      if (frame->format != yuv_ctx_.target_fmt) {
-        if (yuv_ctx_.convert(frame) < 0) {
+      if (!outputAccepts(frame->format)) {
+        int64_t begin = av_gettime_relative();
+        int ret = yuv_ctx_.convert(frame);
+        addConvertTime(av_gettime_relative() - begin);
+        if (ret < 0) {
           vp->uploaded = 1;
           return;
         }
         // av_frame_unref(frame);
         frame = yuv_ctx_.frame_;
       }
-      onIYUVDisplay(frame, vp->pts, ptsToFrameId(vp->pts));
+      FrameTiming timing;
+      timing.demuxed = vp->demuxed;
+      timing.decoded = vp->decoded;
+      timing.presented = av_gettime_relative();
+      if (timing.demuxed) {
+        decodeLatency_.add(timing.decoded - timing.demuxed);
+        presentLatency_.add(timing.presented - timing.demuxed);
+      }
+
+      Detection_t det;
+      bool has_det = detections_.find(vp->serial, vp->pts, DETECTION_HOLD, det);
+      onIYUVDisplay(frame, vp->pts, ptsToFrameId(vp->pts), timing, has_det ? &det : nullptr);
+      markStartup(STARTUP_FIRST_DISPLAY);
+      framesDisplayed_++;
+
+      double diff = fabs(avDiff());
+      if (!isnan(diff)) {
+        int bucket = 0;
+        while (diff > av_drift_bounds[bucket])
+          bucket++;
+        avDrift_[bucket]++;
+      }
     }
 		vp->uploaded = 1;
 	}
@@ -3599,17 +4953,23 @@ void PlayBackContext::video_image_display()
             sub_rect->y = av_clip(sub_rect->y, 0, sp->height);
             sub_rect->w = av_clip(sub_rect->w, 0, sp->width  - sub_rect->x);
             sub_rect->h = av_clip(sub_rect->h, 0, sp->height - sub_rect->y);
-
-            if (sub_yuv_ctx_.convert(AV_PIX_FMT_PAL8, sub_rect->w, sub_rect->h, (const uint8_t * const *)sub_rect->data, sub_rect->linesize) >= 0) {
-
-            }
           }
+
+          shownSubtitle_ = rasterize_subtitle(sp);
+          if (onSubtitle)
+            onSubtitle(shownSubtitle_);
           sp->uploaded = 1;
         }
       } else
         sp = nullptr;
     }
   }
+
+  if (!sp && shownSubtitle_) {
+    shownSubtitle_.reset();
+    if (onSubtitle)
+      onSubtitle(nullptr);
+  }
 }
 
 double PlayBackContext::vp_duration(const Frame *vp, const Frame *nextvp) const {
@@ -3653,6 +5013,156 @@ double PlayBackContext::compute_target_delay(double delay) const {
   return delay;
 }
 
+/* first thread to reach the phase stamps it */
+void PlayBackContext::markStartup(StartupPhase phase) {
+  int64_t unset = 0;
+  startupStamps_[phase].compare_exchange_strong(unset, av_gettime_relative());
+}
+
+/* once the picture and the sound of the selected streams are out */
+void PlayBackContext::reportStartup() {
+  bool complete = startupStamps_[STARTUP_CODEC_OPEN] &&
+                  (!this->video_st || startupStamps_[STARTUP_FIRST_DISPLAY]) &&
+                  (!this->audio_st || startupStamps_[STARTUP_FIRST_AUDIO]);
+
+  if (!complete && av_gettime_relative() - startupBegin_ < STARTUP_REPORT_TIMEOUT)
+    return;
+
+  startupReported_ = true;
+
+  StartupTimes times;
+  for (int i = 0; i < STARTUP_PHASE_NB; i++) {
+    int64_t stamp = startupStamps_[i];
+    times.phases[i] = stamp ? (stamp - startupBegin_) / 1000000.0 : -1.0;
+  }
+
+  av_log(NULL, AV_LOG_VERBOSE, "startup: open %0.3f probe %0.3f codec %0.3f packet %0.3f frame %0.3f display %0.3f audio %0.3f\n",
+      times.phases[STARTUP_OPEN], times.phases[STARTUP_PROBE], times.phases[STARTUP_CODEC_OPEN],
+      times.phases[STARTUP_FIRST_PACKET], times.phases[STARTUP_FIRST_FRAME],
+      times.phases[STARTUP_FIRST_DISPLAY], times.phases[STARTUP_FIRST_AUDIO]);
+
+  if (onStartup)
+    onStartup(times);
+}
+
+double PlayBackContext::avDiff() const {
+  if (this->audio_st && this->video_st)
+    return this->audclk.get_clock() - this->vidclk.get_clock();
+  else if (this->video_st)
+    return get_master_clock() - this->vidclk.get_clock();
+  else if (this->audio_st)
+    return get_master_clock() - this->audclk.get_clock();
+  return 0;
+}
+
+static void queue_stats(QueueStats& stats, const PacketQueue& queue, const AVStream *st) {
+  stats.packets = queue.packetsCount();
+  stats.bytes = queue.size();
+  stats.seconds = st ? queue.duration() * av_q2d(st->time_base) : 0;
+}
+
+void PlayBackContext::getStats(PlaybackStats& stats) const {
+  statsRequestTime_ = av_gettime_relative();
+  std::lock_guard<std::mutex> lk(statsMtx_);
+  stats = stats_;
+}
+
+/* on the refresh thread, which also opens and closes the streams */
+void PlayBackContext::collectStats(PlaybackStats& stats) const {
+  stats.clock = get_master_clock();
+  stats.av_diff = avDiff();
+
+  queue_stats(stats.audio_queue, audioPacketQueue_, this->audio_st);
+  queue_stats(stats.video_queue, videoPacketQueue_, this->video_st);
+  queue_stats(stats.subtitle_queue, subtitlePacketQueue_, this->subtitle_st);
+
+  stats.decoder_fps = decoderFps_;
+  stats.display_fps = displayFps_;
+  stats.frame_drops_early = this->frame_drops_early;
+  stats.frame_drops_late = this->frame_drops_late;
+  for (int i = 0; i < AV_DRIFT_BUCKETS; i++)
+    stats.av_drift[i] = avDrift_[i];
+  stats.audio_underruns = audioUnderruns_;
+
+  int64_t count = cbLatencyCount_;
+  stats.callback_latency_avg = count ? cbLatencySum_ / (double)count / 1000000.0 : 0;
+  stats.callback_latency_max = cbLatencyMax_ / 1000000.0;
+
+  count = convertCount_;
+  stats.convert_time_avg = count ? convertTimeSum_ / (double)count / 1000000.0 : 0;
+  stats.convert_time_max = convertTimeMax_ / 1000000.0;
+
+  decodeLatency_.get(stats.decode_latency);
+  presentLatency_.get(stats.present_latency);
+  deliverLatency_.get(stats.deliver_latency);
+
+  stats.seek_packets_flushed = 0;
+  for (auto queue : { &audioPacketQueue_, &videoPacketQueue_, &subtitlePacketQueue_, &dataPacketQueue_ })
+    stats.seek_packets_flushed += queue->flushedCount();
+  stats.seek_packets_decoded = audioDecoder_.helperPackets() + videoDecoder_.helperPackets();
+  stats.seek_frames_discarded = helperFramesDiscarded_;
+  stats.seek_decode_time = (audioDecoder_.helperTime() + videoDecoder_.helperTime()) / 1000000.0;
+}
+
+void PlayBackContext::addDeliveryLatency(int64_t latency) {
+  deliverLatency_.add(latency);
+}
+
+void PlayBackContext::addCallbackLatency(int64_t latency) {
+  cbLatencySum_ += latency;
+  cbLatencyCount_++;
+
+  int64_t max = cbLatencyMax_;
+  while (latency > max && !cbLatencyMax_.compare_exchange_weak(max, latency))
+    ;
+}
+
+void PlayBackContext::addConvertTime(int64_t time) {
+  convertTimeSum_ += time;
+  convertCount_++;
+
+  int64_t max = convertTimeMax_;
+  while (time > max && !convertTimeMax_.compare_exchange_weak(max, time))
+    ;
+}
+
+/* sample the frame rates, and emit the periodic stats when asked for */
+void PlayBackContext::updateStats() {
+  auto cur_time = av_gettime_relative();
+
+  if (cur_time - fpsSampleTime_ >= STATS_FPS_INTERVAL) {
+    int64_t decoded = framesDecoded_;
+    int64_t displayed = framesDisplayed_;
+    if (fpsSampleTime_) {
+      double elapsed = (cur_time - fpsSampleTime_) / 1000000.0;
+      decoderFps_ = (decoded - fpsSampleDecoded_) / elapsed;
+      displayFps_ = (displayed - fpsSampleDisplayed_) / elapsed;
+    }
+    fpsSampleTime_ = cur_time;
+    fpsSampleDecoded_ = decoded;
+    fpsSampleDisplayed_ = displayed;
+  }
+
+  bool report = showStatus && onStats && cur_time - statsTime_ >= stats_interval * 1000000;
+  bool snapshot = statsRequestTime_ && cur_time - statsRequestTime_ < STATS_REQUEST_TIMEOUT &&
+                  cur_time - statsSnapshotTime_ >= STATS_SNAPSHOT_INTERVAL;
+  if (!report && !snapshot)
+    return;
+
+  PlaybackStats stats;
+  collectStats(stats);
+  {
+    std::lock_guard<std::mutex> lk(statsMtx_);
+    stats_ = stats;
+  }
+  statsSnapshotTime_ = cur_time;
+
+  if (report) {
+    onStats(stats);
+    statsTime_ = cur_time;
+  }
+}
+
 void PlayBackContext::videoRefreshShowStatus(int64_t& last_time) const {
   auto cur_time = av_gettime_relative();
   if (!last_time || (cur_time - last_time) >= 30000) {
@@ -3661,34 +5171,6 @@ void PlayBackContext::videoRefreshShowStatus(int64_t& last_time) const {
       onClockUpdate(get_master_clock());
     }
 
-    if (showStatus && onLog)
-    {
-      auto aqsize = audioPacketQueue_.size();
-      auto vqsize = videoPacketQueue_.size();
-      auto sqsize = subtitlePacketQueue_.size();
-      double av_diff = 0;
-      if (this->audio_st && this->video_st)
-        av_diff = this->audclk.get_clock() - this->vidclk.get_clock();
-      else if (this->video_st)
-        av_diff = get_master_clock() - this->vidclk.get_clock();
-      else if (this->audio_st)
-        av_diff = get_master_clock() - this->audclk.get_clock();
-              
-      char buffer[512] = {0};
-      snprintf(buffer, sizeof(buffer),
-                    "%7.2f %s:%7.3f fd=%4d aq=%5dKB vq=%5dKB f=%lld/%lld   \r",
-                    get_master_clock(),
-                    (audio_st && video_st) ? "A-V" : (video_st ? "M-V" : (audio_st ? "M-A" : "   ")),
-                    av_diff,
-                    this->frame_drops_early + this->frame_drops_late,
-                    aqsize / 1024,
-                    vqsize / 1024,
-                    video_st ? videoDecoder_.context()->pts_correction_num_faulty_dts : 0,
-                    video_st ? videoDecoder_.context()->pts_correction_num_faulty_pts : 0);
-      // fflush(stderr);
-      onLog(0, buffer);
-    }
-
     last_time = cur_time;
   }
 }
@@ -3715,6 +5197,7 @@ void PlayBackContext::startDataDecode() {
 
   dataPacketQueue_.start();
   data_tid_ = thread([this] {
+    Trace::threadName("data");
     int pkt_serial;
     AVPacket pkt1, *pkt = &pkt1;
     av_init_packet(pkt);
@@ -3749,7 +5232,8 @@ int PlayBackContext::receiveDataPacket(AVPacket *pkt, int& pkt_serial) {
     if (ret < 0)
       return ret; // failed
 
-    if (pkt_serial == dataSerial_)
+    // packets carry the video serial when there are pictures to attach to
+    if (pkt_serial == (this->video_stream >= 0 ? videoSerial_ : dataSerial_))
       return 0;
 
     // discard
@@ -3765,25 +5249,53 @@ int PlayBackContext::pushPacket(AVPacket* pkt, int specified_serial) {
   } else if (pkt->stream_index == this->subtitle_stream) {
     return subtitlePacketQueue_.put(pkt, specified_serial);
   } else if (pkt->stream_index == this->data_stream) {
+    // records are looked up by the pictures of the same serial
+    if (specified_serial < 0 && this->video_stream >= 0)
+      specified_serial = videoSerial_;
     return dataPacketQueue_.put(pkt, specified_serial);
   }
   return -1;
 }
 
 void PlayBackContext::newSerial() {
+  // queues restart empty, an immediate underrun is expected
+  readAheadPrimed_ = false;
   audioPacketQueue_.nextSerial();
   videoPacketQueue_.nextSerial();
   subtitlePacketQueue_.nextSerial();
   dataPacketQueue_.nextSerial();
 }
 
-void PlayBackContext::sendSeekRequest(SeekMethod req, int64_t pos, int64_t rel) {
-  if (seekMethod_ == SEEK_METHOD_NONE) {
-    this->seek_pos = pos;
-    this->seek_rel = rel;
-    seekMethod_ = req;
-    continue_read_thread_.notify_one();
+/* the latest request replaces a pending one, so the read thread only ever
+ * executes the newest target */
+void PlayBackContext::sendSeekRequest(SeekMethod method, int64_t pos, int64_t rel) {
+  SeekRequest req;
+  req.method = method;
+  req.pos = pos;
+  req.rel = rel;
+  seekMailbox_.post(req);
+  continue_read_thread_.notify_one();
+}
+
+/* read thread, starts the pending seek once the current one is done */
+bool PlayBackContext::takeSeekRequest() {
+  if (seekMethod_ != SEEK_METHOD_NONE)
+    return false;
+
+  SeekRequest req;
+  if (!seekMailbox_.take(req)) {
+    if (scrubTarget_ == AV_NOPTS_VALUE || av_gettime_relative() < scrubRefineTime_)
+      return false;
+    // scrubbing settled, land on the exact frame
+    req.method = SEEK_METHOD_POS;
+    req.pos = scrubTarget_;
   }
+
+  this->seek_pos = req.pos;
+  this->seek_rel = req.rel;
+  seekMethod_.store(req.method, std::memory_order_release);
+  scrubTarget_ = AV_NOPTS_VALUE;
+  return true;
 }
 
 void PlayBackContext::updateVolume(int sign, double step) {
@@ -3814,13 +5326,13 @@ void PlayBackContext::toggleMute() {
 
 void PlayBackContext::change_speed(double speed) {
 
-  // do not rewind without video
-  if (speed <= 0 && !video_st) {
+  // do not rewind without video, nor on a demuxer shared with other players
+  if (speed <= 0 && (!video_st || source_)) {
     return;
   }
 
   // double tm = vidclk.pts;
-  auto prev_paused = this->paused;
+  int prev_paused = this->paused;
   if (!prev_paused) {
     this->stream_toggle_pause();
   }
@@ -3959,6 +5471,8 @@ int PlayBackContext::onVideoFrameDecodedReversed(AVFrame *frame, int serial) {
       auto svp = std::move(rewindBuffer_.back());
       rewindBuffer_.pop_back();
 
+      // decoded a while ago, kept out of the latency figures
+      svp.frame->reordered_opaque = 0;
       int ret = queuePicture(svp.frame, svp.pts, svp.duration, svp.frame->pkt_pos, svp.serial);
       av_frame_unref(svp.frame);
       if (ret < 0)
@@ -4067,9 +5581,30 @@ retry:
 }
 
 bool PlayBackContext::videoPacketIsAddonData(AVCodecID codec_id, const AVPacket *pkt) const {
-  return false;
+  return (onAIData || onIYUVDisplay) && detection_sei_present(codec_id, video_nal_length_size_, pkt->data, pkt->size);
 }
 
+/* sei copied from video packets or a packet of the data stream */
 int PlayBackContext::dealWithDataPacket(const AVPacket *pkt, const int pkt_serial) {
+  vector<Detection_t> dets;
+  AVRational time_base = data_time_base_;
+
+  if (this->video_st && pkt->stream_index == this->video_stream) {
+    time_base = this->video_st->time_base;
+    detection_parse_sei(video_codec_id_, video_nal_length_size_, pkt->data, pkt->size, dets);
+  } else {
+    detection_parse_data(pkt->data, pkt->size, dets);
+  }
+
+  int64_t ts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+  double pts = ts == AV_NOPTS_VALUE ? NAN : ts * av_q2d(time_base);
+  for (auto& det : dets) {
+    det.pts = pts;
+    // the serial of the packet, see receiveDataPacket
+    det.serial = pkt_serial;
+    detections_.add(det);
+    if (onAIData)
+      onAIData(det, pts);
+  }
   return 0;
 }
@@ -18,6 +18,13 @@ extern "C" {
 #include <functional>
 #include <vector>
 #include <queue>
+#include <atomic>
+
+#include "input.h"
+#include "source.h"
+#include "trace.h"
+#include "detection.h"
+#include "loudnorm.h"
 
 using namespace std;
 
@@ -47,8 +54,15 @@ enum {
 #define VIDEO_PICTURE_QUEUE_SIZE 3
 #define SUBPICTURE_QUEUE_SIZE 16
 #define SAMPLE_QUEUE_SIZE 9
+#define VIDEO_FILTER_QUEUE_SIZE 2
 #define FRAME_QUEUE_SIZE FFMAX(SAMPLE_QUEUE_SIZE, FFMAX(VIDEO_PICTURE_QUEUE_SIZE, SUBPICTURE_QUEUE_SIZE))
 
+/* default read-ahead budgets, overridable per instance */
+#define DEFAULT_MAX_QUEUE_SIZE (15 * 1024 * 1024)
+#define DEFAULT_MIN_FRAMES 25
+#define DEFAULT_BUFFER_DURATION 1.0
+#define DEFAULT_MAX_BUFFER_DURATION 10.0
+
 typedef struct AudioParams {
     int freq{0};
     int channels{0};
@@ -83,27 +97,40 @@ public:
   PacketQueue(int& serial);
   ~PacketQueue();
 
-  bool has_enough_packets(const AVRational& time_base) const;
+  bool has_enough_packets(const AVRational& time_base, int min_frames, double min_duration) const;
   int size() const { return size_; }
   int packetsCount() const { return nb_packets; }
+  int64_t duration() const { return duration_; }
   bool empty() const { return nb_packets == 0; }
+  // packets dropped unread by nextSerial
+  int64_t flushedCount() const { return flushed_; }
 
   int put(AVPacket *pkt, int specified_serial = -1);
   int put_nullpacket(int stream_index);
-  int get(AVPacket *pkt, int *serial);
+  // queued_time: when the packet was put, av_gettime_relative
+  int get(AVPacket *pkt, int *serial, int64_t *queued_time = nullptr);
   void start();
   void nextSerial();
   void abort();
 
 private:
   void flush();
+  void flush_private();
   int put_private(std::unique_lock<std::mutex>& lk, AVPacket *pkt, int specified_serial);
 
 private:
-  std::queue<std::pair<int, AVPacket>> pkts_;
-  int nb_packets{0};
-  int size_{0};
-  int64_t duration_{0};
+  struct Entry {
+    AVPacket pkt;
+    int serial;
+    int64_t time;
+  };
+
+  std::queue<Entry> pkts_;
+  // read without the lock by the read thread and a shared source
+  std::atomic<int> nb_packets{0};
+  std::atomic<int> size_{0};
+  std::atomic<int64_t> duration_{0};
+  std::atomic<int64_t> flushed_{0};
   bool abort_request_{true};
   std::mutex mtx;
   std::condition_variable cond;
@@ -124,9 +151,12 @@ struct Frame {
   int format{0};
   AVRational sar{0};
   int uploaded{0};
+  int64_t demuxed{0};      /* when its packet was queued, 0 if unknown */
+  int64_t decoded{0};
 };
 
 struct SimpleFrame {
+  SimpleFrame() {}
   SimpleFrame(AVFrame *src_frame, int serial, double pts, double duration) {
     frame = av_frame_alloc();
     av_frame_move_ref(frame, src_frame);
@@ -153,6 +183,7 @@ struct SimpleFrame {
   }
 
   SimpleFrame& operator=(SimpleFrame&& other) {
+    av_frame_free(&this->frame);
     this->frame = other.frame;
     this->serial = other.serial;
     this->pts = other.pts;
@@ -167,6 +198,25 @@ struct SimpleFrame {
   double duration{0};      /* estimated duration of the frame */
 };
 
+// a few frames handed from one pipeline stage to the next
+class SimpleFrameQueue {
+public:
+  explicit SimpleFrameQueue(size_t max_size) : max_size_(max_size) {}
+
+  void start();
+  void abort();    // drops what is queued, wakes both sides
+  // block while full or empty, false once aborted
+  bool put(SimpleFrame&& frame);
+  bool get(SimpleFrame& frame);
+
+private:
+  std::mutex mtx_;
+  std::condition_variable cond_;
+  std::deque<SimpleFrame> frames_;
+  const size_t max_size_;
+  bool abort_{true};
+};
+
 struct FrameQueue {
   FrameQueue(const int& serial, int max_size, bool keep_last);
   ~FrameQueue();
@@ -201,7 +251,7 @@ private:
   bool abort_request_{false};
 };
 
-using PacketGetter = std::function<int(AVMediaType codec_type, AVCodecID codec_id, AVPacket *pkt, int *serial)>;
+using PacketGetter = std::function<int(AVMediaType codec_type, AVCodecID codec_id, AVPacket *pkt, int *serial, int64_t *pkt_time)>;
 
 class Decoder {
 public:
@@ -213,6 +263,10 @@ public:
 
   void abort();
   bool finished() const;
+  // with defer_finish, the end of the stream is only reported by takeDrained()
+  // and the owner calls finish() once the later stages are empty too
+  bool takeDrained();
+  void finish(int serial) { finished_ = serial; }
   int decodeFrame(PacketGetter packet_getter, AVFrame *frame, AVSubtitle *sub, int& pkt_serial);
 
   template<class LoopFunc>
@@ -227,20 +281,32 @@ public:
   bool valid() const { return !!avctx_; }
   const AVCodecContext* context() const { return avctx_; }
 
+  // decoding spent on packets before a seek target
+  int64_t helperPackets() const { return helper_packets_; }
+  int64_t helperTime() const { return helper_time_; }
+
   int64_t start_pts{0};
   AVRational start_pts_tb{0};
   int64_t next_pts{0};
   AVRational next_pts_tb{0};
+  bool helper_skip_loop_filter{false};   // also for packets before a seek target
+  bool defer_finish{false};
 
 private:
   std::thread tid_;
   bool abort_request_{true};
 
   int finished_{0};
+  bool drained_{false};
   const int& serial_;
 
   AVCodecContext *avctx_{nullptr};
+  AVDiscard skip_frame_{AVDISCARD_DEFAULT};   // as configured, restored past a seek target
+  AVDiscard skip_loop_filter_{AVDISCARD_DEFAULT};
+  std::atomic<int64_t> helper_packets_{0};
+  std::atomic<int64_t> helper_time_{0};
   AVPacket pending_pkt_{0};
+  int64_t pending_pkt_time_{0};
   bool packet_pending_{false};
 };
 
@@ -267,7 +333,10 @@ enum MediaCommand {
   MEDIA_CMD_PREV_FRAME,
   MEDIA_CMD_CHAPTER,
   MEDIA_CMD_SEEK,
-  MEDIA_CMD_SPEED
+  MEDIA_CMD_SPEED,
+  MEDIA_CMD_SCRUB,  // arg0=1: seeks by pts show the key frame first
+  MEDIA_CMD_VFILTER,  // arg0: index into the -vf list, built in the background
+  MEDIA_CMD_LOUDNORM  // arg0: on/off, arg1: target LUFS, 0 keeps the current one
 };
 
 /*
@@ -283,7 +352,33 @@ enum SeekMethod {
   SEEK_METHOD_POS,
   SEEK_METHOD_BYTES,
   SEEK_METHOD_REWIND,
-  SEEK_METHOD_REWIND_CONTINUE
+  SEEK_METHOD_REWIND_CONTINUE,
+  SEEK_METHOD_KEYFRAME        // a pos seek that shows the key frame before the target
+};
+
+struct SeekRequest {
+  SeekMethod method{SEEK_METHOD_NONE};
+  int64_t pos{0};
+  int64_t rel{0};
+};
+
+// Latest seek asked for, posted by the event thread and taken by the read
+// thread when it is free. Lock free: the sequence is odd while a request is
+// being written, and counts the requests when even.
+class SeekMailbox {
+public:
+  void post(const SeekRequest& req);
+  // the newest request, if it was not taken yet
+  bool take(SeekRequest& req);
+  // a request newer than the last one taken is waiting
+  bool pending() const { return seq_.load(std::memory_order_acquire) / 2 != taken_; }
+
+private:
+  std::atomic<uint64_t> seq_{0};
+  std::atomic<int> method_{SEEK_METHOD_NONE};
+  std::atomic<int64_t> pos_{0};
+  std::atomic<int64_t> rel_{0};
+  uint64_t taken_{0};   // reader side
 };
 
 typedef struct MediaEvent {
@@ -305,22 +400,198 @@ private:
 };
 
 
+#define MAX_CONVERT_THREADS 8
+
+// runs the slices of the queued jobs on a few threads, each caller takes
+// a share of its own job. One pool serves every converter of the process,
+// so the thread count does not grow with the number of players
+class SliceWorkers {
+public:
+  explicit SliceWorkers(int threads);
+  ~SliceWorkers();
+
+  // hardware_concurrency - 1 threads, at most MAX_CONVERT_THREADS - 1,
+  // started on first use
+  static SliceWorkers& shared();
+
+  // returns once slice(0) .. slice(count - 1) all ran
+  void run(int count, const std::function<void(int)>& slice);
+
+private:
+  struct Job {
+    const std::function<void(int)> *slice;
+    int count;
+    int next;
+    int pending;
+  };
+
+  void work();
+  // the next slice of job, which leaves the queue with its last one
+  int take(Job *job);
+
+  std::vector<std::thread> threads_;
+  std::mutex mtx;
+  std::condition_variable cond;
+  std::condition_variable done_cond;
+  std::vector<Job*> jobs_;
+  bool quit_{false};
+};
+
 struct ConverterContext {
   ConverterContext(AVPixelFormat fmt);
   ~ConverterContext();
 
+  // into frame_, which holds a pooled buffer until the next conversion;
+  // av_frame_ref it to keep the picture longer
   int convert(AVFrame *frame);
   int convert(int src_format, int src_width, int src_height, const uint8_t * const*pixels, int* pitch);
 
   struct SwsContext *convert_ctx{nullptr};
-  uint8_t* buffer{nullptr};
-  int buffer_size_{0};
 
   AVFrame *frame_{nullptr};
-  const AVPixelFormat target_fmt{AV_PIX_FMT_NONE};
+  AVPixelFormat target_fmt{AV_PIX_FMT_NONE};   // may be changed between conversions
+
+  // into a frame of its own, allocated here; props are copied from the source
+  int convert(const AVFrame *src_frame, AVFrame *dst_frame);
+
+  int threads{1};   // large pictures are converted in this many horizontal bands
+  int dst_width{0}; // scale to, 0 = source size, only for a frame of its own
+  int dst_height{0};
+
+private:
+  int getBuffer(AVFrame *frame, int width, int height, int align);
+  int scale(int src_format, int src_width, int src_height, const uint8_t * const*pixels, int* pitch,
+            uint8_t * const*dst, int *dst_linesize, int width, int height);
+  int sliceCount(int src_format, int src_height) const;
+  int convertSlices(int slices, int src_format, int src_width, int src_height, const uint8_t * const*pixels, int* pitch,
+                    uint8_t * const*dst_data, int *dst_linesize);
+
+  // output buffers, recycled when the last reference to a picture goes;
+  // a new size starts a new pool, the old one lives on with its pictures
+  AVBufferPool *pool_{nullptr};
+  int pool_buffer_size_{0};
+
+  vector<SwsContext*> slice_ctxs_;   // one per band, each sees its band as a whole picture
 };
 
-struct Detection_t;
+#ifdef BUILD_WITH_VIDEO_FILTER
+// a configured video chain for one input format and -vf entry. A seek
+// starts on a fresh one, the spare the filter thread builds ahead, so
+// filters keeping timestamp state never see pts go back
+struct VideoFilter {
+  ~VideoFilter() { avfilter_graph_free(&graph); }
+
+  bool accepts(const AVFrame *frame) const {
+    return frame->width == width && frame->height == height && frame->format == format;
+  }
+  bool sameAs(const VideoFilter& other) const {
+    return idx == other.idx && width == other.width && height == other.height && format == other.format;
+  }
+
+  AVFilterGraph *graph{nullptr};
+  AVFilterContext *in{nullptr};
+  AVFilterContext *out{nullptr};
+  int width{0};
+  int height{0};
+  int format{AV_PIX_FMT_NONE};
+  int idx{0};     // of vfilters_list
+};
+#endif
+
+enum StartupPhase {
+  STARTUP_OPEN = 0,       // avformat_open_input returned
+  STARTUP_PROBE,          // stream parameters known
+  STARTUP_CODEC_OPEN,     // decoders and audio output opened
+  STARTUP_FIRST_PACKET,   // first packet demuxed
+  STARTUP_FIRST_FRAME,    // first frame decoded
+  STARTUP_FIRST_DISPLAY,  // first picture handed to onIYUVDisplay
+  STARTUP_FIRST_AUDIO,    // first audio callback filled with decoded samples
+  STARTUP_PHASE_NB
+};
+
+// seconds since streamOpen for each phase, negative when not reached
+struct StartupTimes {
+  double phases[STARTUP_PHASE_NB];
+};
+
+/* buckets of the A-V drift histogram, av_drift_bounds holds their upper
+ * bounds of |A-V| in seconds */
+#define AV_DRIFT_BUCKETS 8
+extern const double av_drift_bounds[AV_DRIFT_BUCKETS];
+
+struct LatencyStats {
+  double p50{0};
+  double p90{0};
+  double p99{0};
+};
+
+struct QueueStats {
+  int packets{0};
+  int64_t bytes{0};
+  double seconds{0};
+};
+
+struct PlaybackStats {
+  double clock{0};            // master clock
+  double av_diff{0};
+  QueueStats audio_queue;
+  QueueStats video_queue;
+  QueueStats subtitle_queue;
+  double decoder_fps{0};      // video frames decoded per second
+  double display_fps{0};      // pictures handed to onIYUVDisplay per second
+  int frame_drops_early{0};
+  int frame_drops_late{0};
+  int64_t av_drift[AV_DRIFT_BUCKETS]{};  // displayed pictures per |A-V| bucket
+  int64_t audio_underruns{0};            // audio callbacks that had to play silence
+  double callback_latency_avg{0};        // seconds from engine to JS, as reported by the bridge
+  double callback_latency_max{0};
+  double convert_time_avg{0};            // seconds per picture converted for onIYUVDisplay
+  double convert_time_max{0};
+  LatencyStats decode_latency;    // demux to decoded picture
+  LatencyStats present_latency;   // demux to presentation
+  LatencyStats deliver_latency;   // demux to the yuv event reaching JS
+  int64_t seek_packets_flushed{0};   // queued packets dropped by seeks
+  int64_t seek_packets_decoded{0};   // packets before a seek target sent to the decoders
+  int64_t seek_frames_discarded{0};  // frames decoded from them and thrown away
+  double seek_decode_time{0};        // seconds spent decoding them
+};
+
+// when a picture went through each stage, av_gettime_relative, 0 if unknown
+struct FrameTiming {
+  int64_t demuxed{0};
+  int64_t decoded{0};
+  int64_t presented{0};
+};
+
+// the most recent samples of a latency, for percentiles
+class LatencyWindow {
+public:
+  void add(int64_t sample);
+  void get(LatencyStats& stats) const;
+
+private:
+  mutable std::mutex mtx;
+  vector<int64_t> samples_;
+  size_t next_{0};
+};
+
+// the rects of one subtitle event, rasterized once when it is shown
+struct SubtitleOverlay {
+  struct Rect {
+    int x{0};
+    int y{0};
+    int w{0};
+    int h{0};
+    vector<uint8_t> rgba;   // premultiplied, w * 4 bytes per row; empty for text
+    string text;            // text and ass events are passed on as such
+    string ass;
+  };
+  double pts{0};
+  double end{0};            // NAN if open ended
+  int width{0};             // picture the rects are positioned on
+  int height{0};
+  vector<Rect> rects;
+};
 
 using OnStatus = std::function<void(MediaStatus)>;
 using OnMetaInfo = std::function<void(
@@ -331,11 +602,18 @@ using OnMetaInfo = std::function<void(
     const char*)>;
 using OnStatics = std::function<void(double fps, double tbr, double tbn, double tbc)>;
 using OnClockUpdate = std::function<void(double timestamp)>;
-using OnIYUVDisplay = std::function<void(AVFrame*, double pts, int64_t id)>;
+// det is the detection record shown with the picture, null if none
+using OnIYUVDisplay = std::function<void(AVFrame*, double pts, int64_t id, const FrameTiming& timing, const Detection_t *det)>;
 using OnAIData = std::function<void(const Detection_t& det, double pts)>;
 using OnLog = std::function<void(int, const string&)>;
+using OnStartup = std::function<void(const StartupTimes&)>;
+using OnStats = std::function<void(const PlaybackStats&)>;
+// null when the shown subtitle is taken down
+using OnSubtitle = std::function<void(const shared_ptr<const SubtitleOverlay>&)>;
 
 class PlayBackContext {
+  friend class SharedSource;
+
 public:
   virtual ~PlayBackContext();
   PlayBackContext();
@@ -343,6 +621,16 @@ public:
   void eventLoop(int argc, char **argv);
   void sendEvent(int event, int arg0, double arg1, double arg2);
 
+  // the latest snapshot taken by the refresh thread, callable from any
+  // thread while the context lives. The refresh thread only keeps the
+  // snapshot current while it is being asked for, so the first call
+  // after more than 5 s without one returns an old snapshot
+  void getStats(PlaybackStats& stats) const;
+  // the bridge reports how long a callback waited for the JS thread
+  void addCallbackLatency(int64_t latency);
+  // demux to delivery of a picture, from the bridge
+  void addDeliveryLatency(int64_t latency);
+
 protected:
   const Clock& masterClock() const;
   int get_master_sync_type() const;
@@ -353,6 +641,7 @@ protected:
   double frameIdToPts(int64_t id) const;
 
   void streamOpen();
+  void openInput();
   void streamClose();
   void streamComponentOpen(int stream_index);
   void streamComponentClose(int stream_index);
@@ -360,6 +649,13 @@ protected:
   static int decode_interrupt_cb(void *ctx);
 
   void doReadInThread();
+  void doFollowSourceInThread();
+
+  // called by the shared source, under its lock
+  bool playsStream(int stream_index) const;
+  int pushSourcePacket(AVPacket *pkt, bool helper);
+  void onSourceSeeked(int64_t target, bool by_bytes);
+  void onSourceEof();
 
   void audioOpen(int64_t wanted_channel_layout, int wanted_nb_channels, int wanted_sample_rate);
   static void sdl_audio_callback(void *opaque, Uint8 *stream, int len);
@@ -367,7 +663,13 @@ protected:
   int synchronize_audio(int nb_samples);
 
   void configureAudioFilters(bool force_output_format);
-  int configure_video_filters(AVFilterGraph *graph, const char *vfilters, AVFrame *frame);
+  int configure_video_filters(AVFilterGraph *graph, const char *vfilters, int width, int height, int format,
+                              AVFilterContext **in, AVFilterContext **out);
+#ifdef BUILD_WITH_VIDEO_FILTER
+  std::unique_ptr<VideoFilter> buildVideoFilter(int idx, int width, int height, int format);
+  void startVideoFilterThread();
+  void stopVideoFilterThread();
+#endif
 
   void onPacketDrained();
 
@@ -405,8 +707,21 @@ protected:
   void stream_toggle_pause();
 
   void videoRefreshShowStatus(int64_t& last_time) const;
+  double avDiff() const;
+  void updateStats();
+  void collectStats(PlaybackStats& stats) const;
+  void addConvertTime(int64_t time);
+  bool outputAccepts(int format) const;
+
+  void markStartup(StartupPhase phase);
+  void reportStartup();
+
+  int64_t queuedBytes() const;
+  bool queuesFull() const;
+  void updateReadAhead();
 
   void sendSeekRequest(SeekMethod req, int64_t pos, int64_t rel = 0);
+  bool takeSeekRequest();
 
   void updateVolume(int sign, double step);
   void setVolume(int val);
@@ -436,22 +751,64 @@ protected:
   bool realtime_{false};
 
   AVFormatContext *ic{nullptr};
+  std::unique_ptr<InputSource> input_;
+  shared_ptr<SharedSource> source_;  // ic is borrowed from it when set
 
   // seeking & speed
-  SeekMethod seekMethod_{SEEK_METHOD_NONE};
-  bool rewind_{false};
+  SeekMailbox seekMailbox_;
+  bool scrubbing_{false};
+  int64_t scrubTarget_{AV_NOPTS_VALUE};  // refined by an accurate seek once scrubbing settles
+  int64_t scrubRefineTime_{0};
+  std::atomic<SeekMethod> seekMethod_{SEEK_METHOD_NONE};   // being executed by the read thread
+  std::atomic<bool> rewind_{false};
   int64_t seek_pos{0};
   int64_t seek_rel{0};
   int read_pause_return{0};
-  double speed_{1.0};
+  std::atomic<double> speed_{1.0};
   double prev_speed_{0};
-  bool stepping_{false};
+  std::atomic<bool> stepping_{false};
 
   std::deque<SimpleFrame> rewindBuffer_;
   int64_t frameRewindTarget_;
   int64_t rewindEofPts_{0};
   int64_t syncVideoPts_{-1};
 
+  // adaptive read-ahead, in seconds per stream
+  std::atomic<double> readAheadDuration_{DEFAULT_BUFFER_DURATION};
+  int64_t readAheadAdjustTime_{0};
+  bool readAheadPrimed_{false};
+
+  // startup breakdown, stamped from the thread reaching each phase
+  int64_t startupBegin_{0};
+  std::atomic<int64_t> startupStamps_[STARTUP_PHASE_NB]{};
+  bool startupReported_{false};
+
+  // metrics, see getStats
+  std::atomic<int64_t> framesDecoded_{0};
+  std::atomic<int64_t> helperFramesDiscarded_{0};
+  std::atomic<int64_t> framesDisplayed_{0};
+  std::atomic<int64_t> audioUnderruns_{0};
+  std::atomic<int64_t> avDrift_[AV_DRIFT_BUCKETS]{};
+  std::atomic<int64_t> cbLatencySum_{0};
+  std::atomic<int64_t> cbLatencyCount_{0};
+  std::atomic<int64_t> cbLatencyMax_{0};
+  std::atomic<int64_t> convertTimeSum_{0};
+  std::atomic<int64_t> convertCount_{0};
+  std::atomic<int64_t> convertTimeMax_{0};
+  double decoderFps_{0};
+  double displayFps_{0};
+  int64_t fpsSampleTime_{0};
+  int64_t fpsSampleDecoded_{0};
+  int64_t fpsSampleDisplayed_{0};
+  int64_t statsTime_{0};
+  int64_t statsSnapshotTime_{0};
+  mutable std::atomic<int64_t> statsRequestTime_{0};
+  mutable std::mutex statsMtx_;
+  PlaybackStats stats_;
+  LatencyWindow decodeLatency_;
+  LatencyWindow presentLatency_;
+  LatencyWindow deliverLatency_;
+
   double max_frame_duration{0};      // maximum duration of a frame - above this, we consider the jump a timestamp discontinuity
   int last_video_stream{-1};
   int last_audio_stream{-1};
@@ -495,6 +852,10 @@ protected:
   PacketQueue videoPacketQueue_;
   FrameQueue pictureQueue_;
   Decoder videoDecoder_;
+#ifdef BUILD_WITH_VIDEO_FILTER
+  SimpleFrameQueue videoFilterQueue_{VIDEO_FILTER_QUEUE_SIZE};   // decoded, not yet filtered
+  std::thread videoFilterTid_;
+#endif
 
   int subtitle_stream{-1};
   AVStream *subtitle_st{nullptr};
@@ -508,16 +869,16 @@ protected:
   std::thread data_tid_;
 
   double frame_last_returned_time{0};
-  double frame_last_filter_delay{0};
+  std::atomic<double> frame_last_filter_delay{0};   // set by the filter stage, read by the decoder
 
-  int paused{0};
+  std::atomic<int> paused{0};  // set by the event thread, followed by the others
   int last_paused{0};
   int queue_attachments_req{0};
 
   SDL_AudioDeviceID audio_dev{0};
 
 #if defined(BUILD_WITH_AUDIO_FILTER) || defined(BUILD_WITH_VIDEO_FILTER)
-    int vfilter_idx{0};
+    std::atomic<int> vfilter_idx{0};
     AVFilterContext *in_video_filter{nullptr};   // the first filter in the video chain
     AVFilterContext *out_video_filter{nullptr};  // the last filter in the video chain
     AVFilterContext *in_audio_filter{nullptr};   // the first filter in the audio chain
@@ -533,7 +894,7 @@ protected:
   int dataSerial_{0};
   int subtitleSerial_{0};
 
-  bool abort_reading_{false};
+  std::atomic<bool> abort_reading_{false};
   bool eof_{false};
   std::thread read_tid_;
   std::condition_variable continue_read_thread_;
@@ -541,14 +902,16 @@ protected:
 
   EventQueue evq_;
 
-  // video
-  int frame_drops_early{0};
-  int frame_drops_late{0};
+  // video, counted on the decoder and refresh threads
+  std::atomic<int> frame_drops_early{0};
+  std::atomic<int> frame_drops_late{0};
 
   bool drop_frame_mode{false};
 
   AVRational data_time_base_{1, AV_TIME_BASE};
   AVRational video_time_base_{1, AV_TIME_BASE};
+  AVCodecID video_codec_id_{AV_CODEC_ID_NONE};
+  int video_nal_length_size_{0};   // of the sei scan, 0 for annex b
   AVRational video_frame_rate_{0};
   double frame_duration_{0};
 
@@ -557,7 +920,9 @@ protected:
   double frame_timer_{0};
 
   ConverterContext yuv_ctx_;
-  ConverterContext sub_yuv_ctx_;
+  ConverterContext decode_yuv_ctx_;   // video decoder thread, see convert_in_decoder
+  shared_ptr<const SubtitleOverlay> shownSubtitle_;
+  DetectionTimeline detections_;
 
 public:
   OnStatus onStatus;
@@ -567,6 +932,9 @@ public:
   OnIYUVDisplay onIYUVDisplay;
   OnAIData onAIData;
   OnLog onLog;
+  OnStartup onStartup;
+  OnStats onStats;
+  OnSubtitle onSubtitle;
 
 public:
   AVDictionary *swr_opts{nullptr};
@@ -589,6 +957,19 @@ public:
   AVInputFormat *iformat{nullptr};
   string filename;
 
+  int64_t prefetch_size{0};  // read-ahead window of the local file I/O thread, 0 = off
+  bool prefetch_direct{false};
+  bool mmap_input{false};    // serve local files from a process wide shared mapping
+  bool shared_source{false}; // demux once for every context playing the same url
+  bool fast_start{false};    // cap probing and cache the probed stream parameters
+  bool seek_skip_loop_filter{false};
+  int convert_threads{0};    // pixel format conversion threads, 0 = auto
+  // handed to onIYUVDisplay as decoded, others are converted to the first
+  vector<AVPixelFormat> out_pix_fmts{ AV_PIX_FMT_YUV420P };
+  bool convert_in_decoder{false};  // pictures enter the queue ready for onIYUVDisplay
+  int convert_width{0};      // and scaled to this size, 0 = source size
+  int convert_height{0};
+
   bool fast{false};
   bool genpts{false};
   int lowres{0};
@@ -598,21 +979,28 @@ public:
   int framedrop{-1};
   int infinite_buffer{-1};
 
+  int64_t max_queue_size{DEFAULT_MAX_QUEUE_SIZE};   // byte budget of all packet queues
+  int min_frames{DEFAULT_MIN_FRAMES};
+  double buffer_duration{DEFAULT_BUFFER_DURATION};  // wanted read-ahead per stream, in seconds
+  double max_buffer_duration{DEFAULT_MAX_BUFFER_DURATION};
+  bool adaptive_buffer{true};
+
 #if defined(BUILD_WITH_AUDIO_FILTER) || defined(BUILD_WITH_VIDEO_FILTER)
   vector<string> vfilters_list;
   string afilters;
   int filter_nbthreads{0};
 #endif
 
+  // followed by the audio decoder, also changed at runtime
+  std::atomic<bool> loudnorm{false};
+  std::atomic<double> loudnorm_target{LOUDNORM_DEFAULT_TARGET};
+  int loudnorm_lookahead{5};   // ms, the delay it adds
+
   string audio_codec_name;
   string subtitle_codec_name;
   string video_codec_name;
 
-  bool showStatus{false};
+  bool showStatus{false};    // periodic onStats
+  double stats_interval{1.0};
 };
 
-//
-//
-struct Detection_t {
-  double pts;
-};
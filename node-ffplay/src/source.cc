@@ -0,0 +1,320 @@
+#include "source.h"
+#include "player.h"
+
+extern "C" {
+#include "libavutil/time.h"
+}
+
+#include <unordered_map>
+#include <algorithm>
+#include <chrono>
+#include <future>
+using namespace std::chrono_literals;
+
+///
+SharedSource::SharedSource(const string& url, AVFormatContext *ic, std::unique_ptr<InputSource> input)
+: url_(url)
+, ic_(ic)
+, input_(std::move(input))
+{
+  // the opening subscriber may leave before the others
+  ic_->interrupt_callback.callback = decode_interrupt_cb;
+  ic_->interrupt_callback.opaque = this;
+  if (input_)
+    input_->setInterruptCallback(ic_->interrupt_callback);
+
+  for (int i = 0; i < ic_->nb_streams; i++)
+    ic_->streams[i]->discard = AVDISCARD_ALL;
+  discard_.assign(ic_->nb_streams, AVDISCARD_ALL);
+  synced_.assign(ic_->nb_streams, true);
+}
+
+SharedSource::~SharedSource() {
+  {
+    std::unique_lock<std::mutex> lk(mtx);
+    abort_ = true;
+  }
+  cond.notify_all();
+  if (read_tid_.joinable())
+    read_tid_.join();
+
+  avformat_close_input(&ic_);
+  // custom pb is not closed with the format context
+  input_.reset();
+}
+
+shared_ptr<SharedSource> SharedSource::acquire(const string& url, const Opener& open) {
+  static std::mutex registry_mtx;
+  static std::unordered_map<string, weak_ptr<SharedSource>> registry;
+  // urls being opened, later opens of the same url wait for the first
+  static std::unordered_map<string, std::shared_future<shared_ptr<SharedSource>>> opening;
+
+  std::unique_lock<std::mutex> lk(registry_mtx);
+
+  for (auto it = registry.begin(); it != registry.end();) {
+    if (it->second.expired())
+      it = registry.erase(it);
+    else
+      ++it;
+  }
+
+  auto it = registry.find(url);
+  if (it != registry.end()) {
+    if (auto source = it->second.lock())
+      return source;
+  }
+
+  auto pending = opening.find(url);
+  if (pending != opening.end()) {
+    auto source = pending->second;
+    lk.unlock();
+    // the error of the first open, if it failed
+    return source.get();
+  }
+
+  // the open probes the source, other urls must not wait for it
+  std::promise<shared_ptr<SharedSource>> promise;
+  opening[url] = promise.get_future().share();
+  lk.unlock();
+
+  shared_ptr<SharedSource> source;
+  try {
+    AVFormatContext *ic = nullptr;
+    std::unique_ptr<InputSource> input;
+    open(ic, input);
+    source.reset(new SharedSource(url, ic, std::move(input)));
+  } catch (...) {
+    lk.lock();
+    opening.erase(url);
+    promise.set_exception(std::current_exception());
+    throw;
+  }
+
+  lk.lock();
+  registry[url] = source;
+  opening.erase(url);
+  promise.set_value(source);
+  return source;
+}
+
+int SharedSource::decode_interrupt_cb(void *ctx) {
+  auto source = (SharedSource*)ctx;
+  return source->abort_;
+}
+
+void SharedSource::subscribe(PlayBackContext *sub) {
+  std::unique_lock<std::mutex> lk(mtx);
+  subscribers_.push_back(sub);
+  updateDiscard();
+
+  if (eof_)
+    sub->onSourceEof();
+
+  if (!read_tid_.joinable()) {
+    read_tid_ = std::thread([this] {
+      Trace::threadName("shared source");
+      doReadInThread();
+    });
+  }
+}
+
+void SharedSource::unsubscribe(PlayBackContext *sub) {
+  {
+    std::unique_lock<std::mutex> lk(mtx);
+    auto it = std::find(subscribers_.begin(), subscribers_.end(), sub);
+    if (it == subscribers_.end())
+      return;
+    subscribers_.erase(it);
+    updateDiscard();
+  }
+  // it may have been the one holding reading back
+  cond.notify_one();
+}
+
+void SharedSource::requestSeek(int64_t pos, int64_t rel, bool by_bytes) {
+  {
+    std::unique_lock<std::mutex> lk(mtx);
+    // the latest request wins
+    seek_pos_ = pos;
+    seek_rel_ = rel;
+    seek_by_bytes_ = by_bytes;
+    seek_req_ = true;
+  }
+  cond.notify_one();
+}
+
+void SharedSource::wakeup() {
+  cond.notify_one();
+}
+
+bool SharedSource::failed() const {
+  return error_;
+}
+
+/* read only the streams some subscriber plays, the demuxer may be in
+ * av_read_frame so the read thread applies it */
+void SharedSource::updateDiscard() {
+  discard_.assign(ic_->nb_streams, AVDISCARD_ALL);
+
+  for (auto sub : subscribers_) {
+    for (int index : { sub->audio_stream, sub->video_stream, sub->subtitle_stream, sub->data_stream }) {
+      if (index >= 0 && index < ic_->nb_streams)
+        discard_[index] = AVDISCARD_DEFAULT;
+    }
+  }
+  discard_changed_ = true;
+}
+
+void SharedSource::applyDiscard() {
+  if (!discard_changed_)
+    return;
+
+  for (int i = 0; i < ic_->nb_streams; i++)
+    ic_->streams[i]->discard = discard_[i];
+  discard_changed_ = false;
+}
+
+/* the slowest playing subscriber paces the source, paused ones only
+ * when all of them are */
+bool SharedSource::subscribersFull() const {
+  bool playing = false, full = false;
+  for (auto sub : subscribers_) {
+    if (!sub->paused) {
+      playing = true;
+      if (sub->queuesFull())
+        return true;
+    } else if (sub->queuesFull()) {
+      full = true;
+    }
+  }
+  return !playing && full;
+}
+
+void SharedSource::seekLocked(std::unique_lock<std::mutex>& lk) {
+  int64_t seek_target = seek_pos_;
+  int64_t seek_rel = seek_rel_;
+  bool by_bytes = seek_by_bytes_;
+  int ret;
+
+  seek_req_ = false;
+  lk.unlock();
+
+  if (by_bytes) {
+    int64_t seek_min = seek_rel > 0 ? seek_target - seek_rel + 2: INT64_MIN;
+    int64_t seek_max = seek_rel < 0 ? seek_target - seek_rel - 2: INT64_MAX;
+    ret = avformat_seek_file(ic_, -1, seek_min, seek_target, seek_max, AVSEEK_FLAG_BYTE);
+  } else {
+    ret = avformat_seek_file(ic_, -1, INT64_MIN, seek_target, INT64_MAX, 0);
+  }
+
+  lk.lock();
+  if (ret < 0) {
+    av_log(NULL, AV_LOG_ERROR, "%s: error while seeking\n", ic_->url);
+    return;
+  }
+
+  eof_ = false;
+  if (!by_bytes) {
+    sync_pos_ = seek_target;
+    synced_.assign(ic_->nb_streams, false);
+  }
+
+  for (auto sub : subscribers_)
+    sub->onSourceSeeked(seek_target, by_bytes);
+}
+
+void SharedSource::fanOut(AVPacket *pkt) {
+  bool helper = false;
+
+  if (sync_pos_ != AV_NOPTS_VALUE) {
+    AVStream *st = ic_->streams[pkt->stream_index];
+    int64_t pos = av_rescale_q(pkt->pts, st->time_base, AVRational{ 1, AV_TIME_BASE });
+    if (pkt->pts != AV_NOPTS_VALUE && pos >= sync_pos_) {
+      synced_[pkt->stream_index] = true;
+    } else {
+      helper = true; // decoded, not presented
+    }
+
+    bool done = true;
+    for (int i = 0; i < ic_->nb_streams; i++) {
+      AVMediaType type = ic_->streams[i]->codecpar->codec_type;
+      if ((type == AVMEDIA_TYPE_AUDIO || type == AVMEDIA_TYPE_VIDEO) &&
+          ic_->streams[i]->discard != AVDISCARD_ALL && !synced_[i])
+        done = false;
+    }
+    if (done)
+      sync_pos_ = AV_NOPTS_VALUE;
+  }
+
+  for (auto sub : subscribers_) {
+    if (!sub->playsStream(pkt->stream_index))
+      continue;
+
+    // a paused view that cannot take more misses the packet, and its video
+    // restarts at a key frame
+    if (sub->paused && sub->queuesFull()) {
+      sub->drop_frame_mode = true;
+      continue;
+    }
+
+    AVPacket copy;
+    if (av_packet_ref(&copy, pkt) < 0)
+      break;
+    sub->pushSourcePacket(&copy, helper);
+  }
+
+  av_packet_unref(pkt);
+}
+
+void SharedSource::doReadInThread() {
+  AVPacket pkt1, *pkt = &pkt1;
+  std::unique_lock<std::mutex> lk(mtx);
+
+  while (!abort_) {
+    applyDiscard();
+
+    if (seek_req_) {
+      seekLocked(lk);
+      continue;
+    }
+
+    /* if a queue is full, no need to read more */
+    if (subscribers_.empty() || subscribersFull()) {
+      cond.wait_for(lk, 10ms);
+      continue;
+    }
+
+    lk.unlock();
+    int ret;
+    {
+      TRACE_SCOPE("av_read_frame");
+      ret = av_read_frame(ic_, pkt);
+    }
+    lk.lock();
+
+    if (ret < 0) {
+      if ((ret == AVERROR_EOF || avio_feof(ic_->pb)) && !eof_) {
+        for (auto sub : subscribers_)
+          sub->onSourceEof();
+        eof_ = true;
+      }
+      if (ic_->pb && ic_->pb->error) {
+        av_log(NULL, AV_LOG_ERROR, "%s: read error, shared source stopped\n", ic_->url);
+        error_ = true;
+        break;
+      }
+      cond.wait_for(lk, 10ms);
+      continue;
+    }
+
+    eof_ = false;
+
+    // read before a pending seek, belongs to the old position
+    if (seek_req_) {
+      av_packet_unref(pkt);
+      continue;
+    }
+
+    fanOut(pkt);
+  }
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+extern "C" {
+#include "libavformat/avformat.h"
+}
+
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <memory>
+#include <atomic>
+
+#include "input.h"
+
+using namespace std;
+
+class PlayBackContext;
+
+// One demuxer feeding every PlayBackContext opened with -shared_source on
+// the same url. The source owns the format context and the read thread,
+// each packet is referenced into the queues of the subscribers that play
+// its stream. Subscribers keep their own decoders, clocks and output; a
+// seek from any of them moves the source and thus every view. The playing
+// subscribers pace the reading. A paused one does not hold the others back:
+// once its queues are full it misses packets, and its video picks up again
+// at the next key frame.
+class SharedSource {
+public:
+  using Opener = std::function<void(AVFormatContext*& ic, std::unique_ptr<InputSource>& input)>;
+
+  ~SharedSource();
+
+  // the live source of url, or a new one built by open
+  static shared_ptr<SharedSource> acquire(const string& url, const Opener& open);
+
+  AVFormatContext *context() const { return ic_; }
+
+  void subscribe(PlayBackContext *sub);
+  void unsubscribe(PlayBackContext *sub);
+
+  void requestSeek(int64_t pos, int64_t rel, bool by_bytes);
+  void wakeup();
+
+  // the source stopped on an I/O error
+  bool failed() const;
+
+private:
+  SharedSource(const string& url, AVFormatContext *ic, std::unique_ptr<InputSource> input);
+
+  void doReadInThread();
+  void updateDiscard();
+  void applyDiscard();
+  bool subscribersFull() const;
+  void seekLocked(std::unique_lock<std::mutex>& lk);
+  void fanOut(AVPacket *pkt);
+
+  static int decode_interrupt_cb(void *ctx);
+
+private:
+  string url_;
+  AVFormatContext *ic_{nullptr};
+  std::unique_ptr<InputSource> input_;
+
+  vector<PlayBackContext*> subscribers_;
+  // set by subscribers, applied by the read thread between reads
+  vector<AVDiscard> discard_;
+  bool discard_changed_{false};
+
+  bool seek_req_{false};
+  bool seek_by_bytes_{false};
+  int64_t seek_pos_{0};
+  int64_t seek_rel_{0};
+
+  // catch-up after a seek: packets before the target are decoded only
+  int64_t sync_pos_{AV_NOPTS_VALUE};
+  vector<bool> synced_;
+
+  bool eof_{false};
+  std::atomic<bool> error_{false};
+  std::atomic<bool> abort_{false};
+
+  std::thread read_tid_;
+  std::mutex mtx;
+  std::condition_variable cond;
+};
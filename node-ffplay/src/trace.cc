@@ -0,0 +1,148 @@
+#include "trace.h"
+
+extern "C" {
+#include "libavutil/time.h"
+}
+
+#include <stdio.h>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+
+/* events kept per thread, older ones are overwritten */
+#define TRACE_RING_SIZE 16384
+/* rings of ended threads kept for the dump, the oldest go first */
+#define TRACE_MAX_DEAD_RINGS 32
+
+struct TraceEvent {
+  const char *name;
+  int64_t ts;
+  int64_t dur;
+};
+
+// written by its thread only; the dump reads up to the published count
+struct TraceRing {
+  int tid{0};
+  const char *name{nullptr};
+  std::atomic<bool> alive{true};
+  std::atomic<uint64_t> written{0};
+  vector<TraceEvent> events;   // allocated on the first event
+};
+
+// keeps the ring of an ended thread for the next dump
+struct TraceRingHolder {
+  shared_ptr<TraceRing> ring;
+  ~TraceRingHolder() {
+    if (ring)
+      ring->alive = false;
+  }
+};
+
+static std::mutex rings_mtx;
+static vector<shared_ptr<TraceRing>> rings;
+static int next_tid = 1;
+static std::atomic<int64_t> trace_start{0};
+static thread_local TraceRingHolder local_ring;
+
+std::atomic<bool> Trace::enabled_{false};
+
+static TraceRing *ring_of_thread() {
+  if (!local_ring.ring) {
+    auto ring = make_shared<TraceRing>();
+
+    std::lock_guard<std::mutex> lk(rings_mtx);
+    // ended threads that never traced anything
+    rings.erase(std::remove_if(rings.begin(), rings.end(), [](const shared_ptr<TraceRing>& r) {
+      return !r->alive && !r->written;
+    }), rings.end());
+
+    // players opened and closed with tracing left on
+    int dead = (int)std::count_if(rings.begin(), rings.end(), [](const shared_ptr<TraceRing>& r) {
+      return !r->alive;
+    });
+    for (auto it = rings.begin(); dead > TRACE_MAX_DEAD_RINGS && it != rings.end();) {
+      if (!(*it)->alive) {
+        it = rings.erase(it);
+        dead--;
+      } else {
+        ++it;
+      }
+    }
+    ring->tid = next_tid++;
+    rings.push_back(ring);
+    local_ring.ring = ring;
+  }
+  return local_ring.ring.get();
+}
+
+int64_t Trace::now() {
+  return av_gettime_relative();
+}
+
+void Trace::enable(bool on) {
+  if (on) {
+    std::lock_guard<std::mutex> lk(rings_mtx);
+    rings.erase(std::remove_if(rings.begin(), rings.end(), [](const shared_ptr<TraceRing>& r) {
+      return !r->alive;
+    }), rings.end());
+    trace_start = now();
+  }
+  enabled_ = on;
+}
+
+void Trace::threadName(const char *name) {
+  ring_of_thread()->name = name;
+}
+
+void Trace::complete(const char *name, int64_t begin, int64_t end) {
+  auto ring = ring_of_thread();
+  if (ring->events.empty())
+    ring->events.resize(TRACE_RING_SIZE);
+
+  uint64_t n = ring->written.load(std::memory_order_relaxed);
+  auto& ev = ring->events[n % TRACE_RING_SIZE];
+  ev.name = name;
+  ev.ts = begin;
+  ev.dur = end - begin;
+  ring->written.store(n + 1, std::memory_order_release);
+}
+
+string Trace::dump() {
+  string out = "{\"traceEvents\":[";
+  bool first = true;
+  char buf[256];
+  int64_t start = trace_start;
+
+  auto append = [&](const char *event) {
+    if (!first)
+      out += ",\n";
+    out += event;
+    first = false;
+  };
+
+  std::lock_guard<std::mutex> lk(rings_mtx);
+  for (auto& ring : rings) {
+    if (ring->name) {
+      snprintf(buf, sizeof(buf), "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+          ring->tid, ring->name);
+      append(buf);
+    }
+
+    // events overwritten while copying may come out torn, this is a
+    // diagnostic view and does not stop the writers
+    uint64_t n = ring->written.load(std::memory_order_acquire);
+    uint64_t from = n > TRACE_RING_SIZE ? n - TRACE_RING_SIZE : 0;
+    for (uint64_t i = from; i < n; i++) {
+      const TraceEvent ev = ring->events[i % TRACE_RING_SIZE];
+      if (ev.ts < start)
+        continue;
+      snprintf(buf, sizeof(buf), "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"dur\":%lld}",
+          ev.name, ring->tid, (long long)ev.ts, (long long)ev.dur);
+      append(buf);
+    }
+  }
+
+  out += "],\"displayTimeUnit\":\"ms\"}";
+  return out;
+}
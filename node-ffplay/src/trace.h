@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+using namespace std;
+
+// Process wide timeline of the playback stages. Each thread records into a
+// ring of its own, nothing is recorded until enabled, and a disabled trace
+// point costs one relaxed load.
+class Trace {
+public:
+  // enabling starts a fresh timeline
+  static void enable(bool on);
+  static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+
+  // names the calling thread in the dump
+  static void threadName(const char *name);
+
+  // a complete event, timestamps from av_gettime_relative
+  static void complete(const char *name, int64_t begin, int64_t end);
+  static int64_t now();
+
+  // Chrome trace event JSON, loadable in about:tracing
+  static string dump();
+
+private:
+  static std::atomic<bool> enabled_;
+};
+
+class TraceScope {
+public:
+  explicit TraceScope(const char *name)
+  : name_(Trace::enabled() ? name : nullptr)
+  , begin_(name_ ? Trace::now() : 0) {}
+
+  ~TraceScope() {
+    if (name_)
+      Trace::complete(name_, begin_, Trace::now());
+  }
+
+private:
+  const char *name_;
+  int64_t begin_;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+/* traces the enclosing scope, name must be a string literal */
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
@@ -1,9 +1,13 @@
 #include <napi.h>
-#include <uv.h>
 
 #include "player.h"
+extern "C" {
+#include "libavutil/time.h"
+#include "libavutil/pixdesc.h"
+}
 #include <unordered_map>
 #include <set>
+#include <algorithm>
 
 #ifndef NAPI_CPP_EXCEPTIONS
 #error ThreadSafeCallback needs napi exception support
@@ -14,7 +18,8 @@
 #endif
 
 
-static constexpr size_t MAX_CACHE_DETECTION_OBJECTS = 512;
+// bridge calls queued before the producers wait for the main loop
+static constexpr size_t MAX_PENDING_CALLS = 64;
 
 /*
 {
@@ -268,85 +273,184 @@ Napi::Value DecoderObject::Close(const Napi::CallbackInfo& info) {
 }
 
 ////////////////////////////////////////////////////////////////
+// coalesce keys, only the latest of these matters to JS
+enum {
+  CALL_TIME = 1,
+  CALL_STATS,
+  CALL_SUBTITLE,
+};
+
 class ThreadSafeCallback {
 public:
   // The argument function is responsible for providing napi_values which will
   // be used for invoking the callback. Since this touches JS state it must run
   // in the NodeJS main loop.
   using arg_func_t = std::function<void(napi_env, std::vector<napi_value>&)>;
-
-  // Must be called from Node event loop because it calls napi_create_reference and uv_async_init
-  ThreadSafeCallback(const Napi::Function& callback, Napi::Value receiver) {
+  // told how long each call waited for the main loop, in microseconds
+  using delivery_func_t = std::function<void(int64_t)>;
+
+  // Must be called from the Node event loop. One producer thread is counted
+  // in, it gives its count back with release() and the object deletes itself
+  // once the main loop let go of the function too.
+  // batch, when given, takes all the calls of one wakeup as [[...args], ...]
+  ThreadSafeCallback(const Napi::Function& callback, Napi::Value receiver, Napi::Value batch = Napi::Value())
+  : main_tid_(std::this_thread::get_id()) {
     callback_ = Napi::Persistent(callback);
     receiver_ = Napi::Persistent(receiver);
-    uv_async_init(uv_default_loop(), &handle_, &static_async_callback);
-    handle_.data = this;
+    if (!batch.IsEmpty() && batch.IsFunction())
+      batch_ = Napi::Persistent(batch.As<Napi::Function>());
+
+    // carries wakeups only, the calls wait in calls_
+    tsfn_ = Napi::ThreadSafeFunction::New(callback.Env(), callback, "ffplay events", 1, 1,
+        [this](Napi::Env) {
+          if (finalized_)
+            finalized_();
+          delete this;
+        });
   }
 
-  void call(arg_func_t arg_function) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    function_pairs_.push_back(arg_function);
-    uv_async_send(&handle_);
+  // a call with a coalesce key replaces a queued call of the same key that
+  // has not reached JS yet, and takes its place at the back so it does not
+  // overtake the calls made in between. Producers wait while
+  // MAX_PENDING_CALLS are queued, false if the call was dropped because the
+  // bridge is being torn down.
+  bool call(arg_func_t arg_function, int coalesce = 0) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (coalesce) {
+      auto it = std::find_if(calls_.begin(), calls_.end(), [coalesce](const Call& queued) {
+        return queued.coalesce == coalesce;
+      });
+      if (it != calls_.end())
+        calls_.erase(it);
+    }
+
+    // the main loop cannot wait for itself
+    if (std::this_thread::get_id() != main_tid_) {
+      space_.wait(lock, [this] {
+        return aborted_ || calls_.size() < MAX_PENDING_CALLS;
+      });
+    }
+    if (aborted_)
+      return false;
+
+    calls_.push_back(Call{ av_gettime_relative(), coalesce, std::move(arg_function) });
+    if (!wakeup_pending_) {
+      wakeup_pending_ = true;
+      lock.unlock();
+      tsfn_.BlockingCall([this](Napi::Env env, Napi::Function) {
+        async_callback(env);
+      });
+    }
+    return true;
   }
 
-  void close() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    close_ = true;
-    uv_async_send(&handle_);
+  // set before the first call
+  void onDelivered(delivery_func_t delivered) {
+    delivered_ = delivered;
   }
 
+  // main loop, right before the object goes away
+  void onFinalize(std::function<void()> finalized) {
+    finalized_ = finalized;
+  }
+
+  // by the producer thread, once it is done calling
+  void release() {
+    tsfn_.Release();
+  }
+
+  // main loop, the environment is going away: queued calls are dropped
+  // and producers stop waiting
+  void abort() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      aborted_ = true;
+      calls_.clear();
+    }
+    space_.notify_all();
+  }
+
+  bool aborted() const { return aborted_; }
+
 protected:
-  static void static_async_callback(uv_async_t *handle) {
+  // a throwing listener is reported as an uncaught exception, nothing may
+  // leave the thread-safe function callback, and the rest of the batch is
+  // still delivered
+  void invoke(Napi::FunctionReference& callback, const std::vector<napi_value>& args) {
     try {
-      static_cast<ThreadSafeCallback *>(handle->data)->async_callback();
-    } catch (std::exception& e) {
-      Napi::Error::Fatal("", e.what());
-    } catch (...) {
-      Napi::Error::Fatal("", "ERROR: Unknown exception during async callback");
+      callback.MakeCallback(receiver_.Value(), args);
+    } catch (Napi::Error& err) {
+      napi_fatal_exception(callback.Env(), err.Value());
     }
   }
 
-  void async_callback() {
-    auto env = callback_.Env();
+  void async_callback(Napi::Env env) {
+    auto& args = args_;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      wakeup_pending_ = false;
+    }
     while (true) {
-      std::vector<arg_func_t> func_pairs;
       {
         std::lock_guard<std::mutex> lock(mutex_);
-        if (function_pairs_.empty())
+        if (calls_.empty())
           break;
-        else
-          func_pairs.swap(function_pairs_);
+        else  // swapping hands the capacity back and forth across wakeups
+          delivering_.swap(calls_);
       }
+      space_.notify_all();
 
-      for (const auto &func : func_pairs) {
+      if (!batch_.IsEmpty() && delivering_.size() > 1) {
         Napi::HandleScope scope(env);
-        std::vector<napi_value> args;
-        func(env, args);
-
-        Napi::Error error(env, nullptr);
-        try {
-          callback_.MakeCallback(receiver_.Value(), args);
-        } catch (Napi::Error& err) {
-          error = std::move(err);
+        auto events = Napi::Array::New(env, delivering_.size());
+        uint32_t i = 0;
+        for (auto& call : delivering_) {
+          call.args(env, args);
+          if (delivered_)
+            delivered_(av_gettime_relative() - call.time);
+
+          auto event = Napi::Array::New(env, args.size());
+          for (uint32_t j = 0; j < args.size(); j++)
+            event.Set(j, args[j]);
+          events.Set(i++, event);
+        }
+        invoke(batch_, { events });
+      } else {
+        for (auto& call : delivering_) {
+          Napi::HandleScope scope(env);
+          call.args(env, args);
+          if (delivered_)
+            delivered_(av_gettime_relative() - call.time);
+
+          invoke(callback_, args);
         }
-
-        if (!error.IsEmpty())
-          throw std::runtime_error(error.Message());
       }
+      delivering_.clear();
     }
-
-    if (close_)
-      uv_close(reinterpret_cast<uv_handle_t *>(&handle_), [](uv_handle_t *handle) {
-        delete static_cast<ThreadSafeCallback *>(handle->data);
-      });
+    // the handles died with their scopes, the capacity is kept
+    args.clear();
   }
 
+  struct Call {
+    int64_t time;     // queued at
+    int coalesce;
+    arg_func_t args;
+  };
+
+  Napi::ThreadSafeFunction tsfn_;
   Napi::FunctionReference callback_;
+  Napi::FunctionReference batch_;
   Napi::Reference<Napi::Value> receiver_;
-  uv_async_t handle_;
-  std::vector<arg_func_t> function_pairs_;
-  bool close_{false};
+  std::thread::id main_tid_;
+  std::vector<Call> calls_;
+  std::vector<Call> delivering_;   // main loop only
+  std::vector<napi_value> args_;   // main loop only
+  bool wakeup_pending_{false};
+  std::atomic<bool> aborted_{false};
+  delivery_func_t delivered_;
+  std::function<void()> finalized_;
   std::mutex mutex_;
+  std::condition_variable space_;
 
 protected:
   // Cannot be copied or assigned
@@ -366,29 +470,142 @@ public:
 
 private:
   Napi::Value Send(const Napi::CallbackInfo& info);
+  Napi::Value GetStats(const Napi::CallbackInfo& info);
+  Napi::Value DumpTrace(const Napi::CallbackInfo& info);
 
 private:
-  void iyuv_callback(ThreadSafeCallback* safe_callback, AVFrame* frame, double pts, int64_t id);
+  void iyuv_callback(ThreadSafeCallback* safe_callback, AVFrame* frame, double pts, int64_t id, const FrameTiming& timing, const Detection_t *det);
+  static void cleanup(void *arg);
 
 private:
   static Napi::FunctionReference constructor;
   PlayBackContext* ctx_{nullptr};
   vector<string> vargs_;
 
+  napi_env env_{nullptr};
+  ThreadSafeCallback* safe_callback_{nullptr};   // gone once finalized
+  std::thread player_;
+
   mutable std::mutex mtxPlaying_;
 
-  std::deque<Detection_t> pending_dets_;
   mutable mutex mtx_;
   condition_variable cond_;
 };
 
 Napi::FunctionReference PlayBackObject::constructor;
 
+static Napi::Object queueStatsObject(Napi::Env env, const QueueStats& stats) {
+  auto obj = Napi::Object::New(env);
+  obj.Set(Napi::String::New(env, "packets"), Napi::Number::New(env, stats.packets));
+  obj.Set(Napi::String::New(env, "bytes"), Napi::Number::New(env, (double)stats.bytes));
+  obj.Set(Napi::String::New(env, "seconds"), Napi::Number::New(env, stats.seconds));
+  return obj;
+}
+
+static Napi::Object statsObject(Napi::Env env, const PlaybackStats& stats) {
+  auto obj = Napi::Object::New(env);
+  obj.Set(Napi::String::New(env, "clock"), Napi::Number::New(env, stats.clock));
+  obj.Set(Napi::String::New(env, "av_diff"), Napi::Number::New(env, stats.av_diff));
+
+  auto queues = Napi::Object::New(env);
+  queues.Set(Napi::String::New(env, "audio"), queueStatsObject(env, stats.audio_queue));
+  queues.Set(Napi::String::New(env, "video"), queueStatsObject(env, stats.video_queue));
+  queues.Set(Napi::String::New(env, "subtitle"), queueStatsObject(env, stats.subtitle_queue));
+  obj.Set(Napi::String::New(env, "queues"), queues);
+
+  obj.Set(Napi::String::New(env, "decoder_fps"), Napi::Number::New(env, stats.decoder_fps));
+  obj.Set(Napi::String::New(env, "display_fps"), Napi::Number::New(env, stats.display_fps));
+  obj.Set(Napi::String::New(env, "frame_drops_early"), Napi::Number::New(env, stats.frame_drops_early));
+  obj.Set(Napi::String::New(env, "frame_drops_late"), Napi::Number::New(env, stats.frame_drops_late));
+
+  // counts[i] pictures had |A-V| up to bounds[i]
+  auto drift = Napi::Object::New(env);
+  auto bounds = Napi::Array::New(env, AV_DRIFT_BUCKETS);
+  auto counts = Napi::Array::New(env, AV_DRIFT_BUCKETS);
+  for (uint32_t i = 0; i < AV_DRIFT_BUCKETS; i++) {
+    bounds.Set(i, Napi::Number::New(env, av_drift_bounds[i]));
+    counts.Set(i, Napi::Number::New(env, (double)stats.av_drift[i]));
+  }
+  drift.Set(Napi::String::New(env, "bounds"), bounds);
+  drift.Set(Napi::String::New(env, "counts"), counts);
+  obj.Set(Napi::String::New(env, "av_drift"), drift);
+
+  obj.Set(Napi::String::New(env, "audio_underruns"), Napi::Number::New(env, (double)stats.audio_underruns));
+
+  auto latency = Napi::Object::New(env);
+  latency.Set(Napi::String::New(env, "avg"), Napi::Number::New(env, stats.callback_latency_avg));
+  latency.Set(Napi::String::New(env, "max"), Napi::Number::New(env, stats.callback_latency_max));
+  obj.Set(Napi::String::New(env, "callback_latency"), latency);
+
+  auto convert = Napi::Object::New(env);
+  convert.Set(Napi::String::New(env, "avg"), Napi::Number::New(env, stats.convert_time_avg));
+  convert.Set(Napi::String::New(env, "max"), Napi::Number::New(env, stats.convert_time_max));
+  obj.Set(Napi::String::New(env, "convert_time"), convert);
+
+  // demux to each stage of a picture, percentiles in seconds
+  auto stages = Napi::Object::New(env);
+  for (auto stage : { std::make_pair("decode", &stats.decode_latency),
+                      std::make_pair("present", &stats.present_latency),
+                      std::make_pair("deliver", &stats.deliver_latency) }) {
+    auto percentiles = Napi::Object::New(env);
+    percentiles.Set(Napi::String::New(env, "p50"), Napi::Number::New(env, stage.second->p50));
+    percentiles.Set(Napi::String::New(env, "p90"), Napi::Number::New(env, stage.second->p90));
+    percentiles.Set(Napi::String::New(env, "p99"), Napi::Number::New(env, stage.second->p99));
+    stages.Set(Napi::String::New(env, stage.first), percentiles);
+  }
+  obj.Set(Napi::String::New(env, "frame_latency"), stages);
+
+  // work seeks threw away
+  auto seek = Napi::Object::New(env);
+  seek.Set(Napi::String::New(env, "packets_flushed"), Napi::Number::New(env, (double)stats.seek_packets_flushed));
+  seek.Set(Napi::String::New(env, "packets_decoded"), Napi::Number::New(env, (double)stats.seek_packets_decoded));
+  seek.Set(Napi::String::New(env, "frames_discarded"), Napi::Number::New(env, (double)stats.seek_frames_discarded));
+  seek.Set(Napi::String::New(env, "decode_time"), Napi::Number::New(env, stats.seek_decode_time));
+  obj.Set(Napi::String::New(env, "seek_waste"), seek);
+  return obj;
+}
+
+// the shape detection-canvas.js draws
+static Napi::Object detectionObject(Napi::Env env, const Detection_t& det, int64_t frame_id) {
+  auto obj = Napi::Object::New(env);
+  obj.Set(Napi::String::New(env, "version"), Napi::Number::New(env, det.version));
+  obj.Set(Napi::String::New(env, "type"), Napi::Number::New(env, det.type));
+  obj.Set(Napi::String::New(env, "frameId"), Napi::Number::New(env, (double)frame_id));
+  obj.Set(Napi::String::New(env, "pts"), Napi::Number::New(env, det.pts));
+
+  auto objects = Napi::Array::New(env, det.objects.size());
+  for (size_t i = 0; i < det.objects.size(); i++) {
+    const auto& src = det.objects[i];
+    auto o = Napi::Object::New(env);
+    o.Set(Napi::String::New(env, "type"), Napi::Number::New(env, src.type));
+    o.Set(Napi::String::New(env, "score"), Napi::Number::New(env, src.score));
+
+    auto rect = Napi::Array::New(env, 4);
+    for (uint32_t j = 0; j < 4; j++)
+      rect.Set(j, Napi::Number::New(env, src.rect[j]));
+    o.Set(Napi::String::New(env, "rect"), rect);
+
+    if (!src.label.empty())
+      o.Set(Napi::String::New(env, "labelString"), Napi::String::New(env, src.label));
+
+    auto landmarks = Napi::Array::New(env, src.landmarks.size());
+    for (size_t j = 0; j < src.landmarks.size(); j++)
+      landmarks.Set((uint32_t)j, Napi::Number::New(env, src.landmarks[j]));
+    o.Set(Napi::String::New(env, "landmarks"), landmarks);
+
+    objects.Set((uint32_t)i, o);
+  }
+  obj.Set(Napi::String::New(env, "objects"), objects);
+  return obj;
+}
+
 Napi::Object PlayBackObject::Init(Napi::Env env, Napi::Object exports) {
   Napi::HandleScope scope(env);
 
   Napi::Function func = DefineClass(env, "PlayBack", {
-    InstanceMethod("send", &Send)
+    InstanceMethod("send", &Send),
+    InstanceMethod("getStats", &GetStats),
+    InstanceMethod("dumpTrace", &DumpTrace)
   });
 
   constructor = Napi::Persistent(func);
@@ -426,7 +643,27 @@ PlayBackObject::PlayBackObject(const Napi::CallbackInfo& info)
   ctx_ = new PlayBackContext();
 
   //auto safe_callback = new ThreadSafeCallback(callback);
-  auto safe_callback = new ThreadSafeCallback(emit, info.This());
+  auto safe_callback = new ThreadSafeCallback(emit, info.This(),
+      info.This().As<Napi::Object>().Get("emitBatch"));
+
+  // runs on the main thread, the context may be gone already
+  // the player is stopped and joined before a worker or renderer
+  // environment goes away, or after it ended on its own
+  env_ = info.Env();
+  safe_callback_ = safe_callback;
+  napi_add_env_cleanup_hook(env_, cleanup, this);
+  safe_callback->onFinalize([this] {
+    napi_remove_env_cleanup_hook(env_, cleanup, this);
+    if (player_.joinable())
+      player_.join();
+    safe_callback_ = nullptr;
+  });
+
+  safe_callback->onDelivered([this](int64_t latency) {
+    std::lock_guard<std::mutex> lk(mtxPlaying_);
+    if (ctx_)
+      ctx_->addCallbackLatency(latency);
+  });
 
   ctx_->onLog = [this, safe_callback](int level, const string& msg) {
     safe_callback->call([level, msg](Napi::Env env, std::vector<napi_value>& args) {
@@ -441,7 +678,7 @@ PlayBackObject::PlayBackObject(const Napi::CallbackInfo& info)
       // This will run in main thread and needs to construct the
       // arguments for the call
       args = { Napi::String::New(env, "time"), Napi::Number::New(env, timestamp) };
-    });
+    }, CALL_TIME);
   };
 
   ctx_->onStatus = [this, safe_callback](MediaStatus status) {
@@ -502,15 +739,70 @@ PlayBackObject::PlayBackObject(const Napi::CallbackInfo& info)
     });
   };
 
-  ctx_->onIYUVDisplay = [this, safe_callback](AVFrame* frame, double pts, int64_t id) {
-    iyuv_callback(safe_callback, frame, pts, id);
+  ctx_->onStartup = [this, safe_callback](const StartupTimes& times) {
+    safe_callback->call([times](Napi::Env env, std::vector<napi_value>& args) {
+      static const char* names[STARTUP_PHASE_NB] = {
+        "open", "probe", "codec_open", "first_packet", "first_frame", "first_display", "first_audio"
+      };
+      // phases not reached are left out
+      auto info = Napi::Object::New(env);
+      for (int i = 0; i < STARTUP_PHASE_NB; i++) {
+        if (times.phases[i] >= 0)
+          info.Set(Napi::String::New(env, names[i]), Napi::Number::New(env, times.phases[i]));
+      }
+      args = { Napi::String::New(env, "startup"), info };
+    });
+  };
+
+  ctx_->onStats = [this, safe_callback](const PlaybackStats& stats) {
+    safe_callback->call([stats](Napi::Env env, std::vector<napi_value>& args) {
+      args = { Napi::String::New(env, "stats"), statsObject(env, stats) };
+    }, CALL_STATS);
   };
 
-  ctx_->onAIData = [this](const Detection_t& detection, double pts) {
+  ctx_->onIYUVDisplay = [this, safe_callback](AVFrame* frame, double pts, int64_t id, const FrameTiming& timing, const Detection_t *det) {
+    iyuv_callback(safe_callback, frame, pts, id, timing, det);
+  };
+
+  ctx_->onSubtitle = [this, safe_callback](const shared_ptr<const SubtitleOverlay>& overlay) {
+    // the overlay is immutable once shown, the JS thread reads it as is
+    safe_callback->call([overlay](Napi::Env env, std::vector<napi_value>& args) {
+      if (!overlay) {
+        args = { Napi::String::New(env, "subtitle"), env.Null() };
+        return;
+      }
+
+      auto info = Napi::Object::New(env);
+      info.Set(Napi::String::New(env, "pts"), Napi::Number::New(env, overlay->pts));
+      info.Set(Napi::String::New(env, "end"), Napi::Number::New(env, overlay->end));
+      info.Set(Napi::String::New(env, "width"), Napi::Number::New(env, overlay->width));
+      info.Set(Napi::String::New(env, "height"), Napi::Number::New(env, overlay->height));
+
+      auto rects = Napi::Array::New(env, overlay->rects.size());
+      for (size_t i = 0; i < overlay->rects.size(); i++) {
+        const auto& rect = overlay->rects[i];
+        auto obj = Napi::Object::New(env);
+        obj.Set(Napi::String::New(env, "x"), Napi::Number::New(env, rect.x));
+        obj.Set(Napi::String::New(env, "y"), Napi::Number::New(env, rect.y));
+        obj.Set(Napi::String::New(env, "w"), Napi::Number::New(env, rect.w));
+        obj.Set(Napi::String::New(env, "h"), Napi::Number::New(env, rect.h));
+        if (!rect.rgba.empty()) {
+          obj.Set(Napi::String::New(env, "bytes"), Napi::Buffer<uint8_t>::Copy(env, rect.rgba.data(), rect.rgba.size()));
+          obj.Set(Napi::String::New(env, "stride"), Napi::Number::New(env, rect.w * 4));
+        }
+        if (!rect.text.empty())
+          obj.Set(Napi::String::New(env, "text"), Napi::String::New(env, rect.text));
+        if (!rect.ass.empty())
+          obj.Set(Napi::String::New(env, "ass"), Napi::String::New(env, rect.ass));
+        rects.Set((uint32_t)i, obj);
+      }
+      info.Set(Napi::String::New(env, "rects"), rects);
+      args = { Napi::String::New(env, "subtitle"), info };
+    }, CALL_SUBTITLE);
   };
 
   // play
-  std::thread([this, safe_callback] {
+  player_ = std::thread([this, safe_callback] {
 
     vector<char*> argv_;
     argv_.resize(vargs_.size());
@@ -546,14 +838,39 @@ PlayBackObject::PlayBackObject(const Napi::CallbackInfo& info)
       args = { Napi::String::New(env, "end") };
     });
 
-    // close context
+    // close context. Deleting joins the decoder threads, which may still
+    // call into the bridge and wait for the main loop, so it is done
+    // outside the lock the main loop takes
+    PlayBackContext *ctx;
     {
       std::lock_guard<std::mutex> lk(mtxPlaying_);
-      delete ctx_;
+      ctx = ctx_;
       ctx_ = nullptr;
-      safe_callback->close();
     }
-  }).detach();
+    delete ctx;
+    safe_callback->release();
+  });
+}
+
+void PlayBackObject::cleanup(void *arg) {
+  auto self = static_cast<PlayBackObject*>(arg);
+
+  // frees the threads waiting on the main loop first
+  if (self->safe_callback_)
+    self->safe_callback_->abort();
+  {
+    lock_guard<mutex> lock(self->mtx_);
+  }
+  self->cond_.notify_all();
+
+  {
+    lock_guard<mutex> lock(self->mtxPlaying_);
+    if (self->ctx_)
+      self->ctx_->sendEvent(MEDIA_CMD_QUIT, 0, 0, 0);
+  }
+
+  if (self->player_.joinable())
+    self->player_.join();
 }
 
 Napi::Value PlayBackObject::Send(const Napi::CallbackInfo& info) {
@@ -580,6 +897,12 @@ Napi::Value PlayBackObject::Send(const Napi::CallbackInfo& info) {
     arg2 = info[3].As<Napi::Number>().DoubleValue();
   }
 
+  // process wide, needs no running context
+  if (eventStr == "trace") {
+    Trace::enable(arg0 != 0);
+    return Napi::Boolean::New(env, true);
+  }
+
   if (eventStr == "quit") {
     event = MEDIA_CMD_QUIT;
   } else if (eventStr == "pause") {
@@ -599,6 +922,12 @@ Napi::Value PlayBackObject::Send(const Napi::CallbackInfo& info) {
     event = MEDIA_CMD_CHAPTER;
   } else if (eventStr == "speed") {
     event = MEDIA_CMD_SPEED;
+  } else if (eventStr == "scrub") {
+    event = MEDIA_CMD_SCRUB;
+  } else if (eventStr == "vfilter") {
+    event = MEDIA_CMD_VFILTER;
+  } else if (eventStr == "loudnorm") {
+    event = MEDIA_CMD_LOUDNORM;
   }
 
   {
@@ -613,62 +942,110 @@ Napi::Value PlayBackObject::Send(const Napi::CallbackInfo& info) {
   return Napi::Boolean::New(env, true);
 }
 
-void PlayBackObject::iyuv_callback(ThreadSafeCallback* safe_callback, AVFrame* frame, double pts, int64_t id) {
+Napi::Value PlayBackObject::GetStats(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  PlaybackStats stats;
+
+  {
+    lock_guard<mutex> lock(mtxPlaying_);
+    if (!ctx_) {
+      return env.Undefined();
+    }
 
-  unique_lock<mutex> lock(mtx_);
+    ctx_->getStats(stats);
+  }
+
+  return statsObject(env, stats);
+}
+
+Napi::Value PlayBackObject::DumpTrace(const Napi::CallbackInfo& info) {
+  return Napi::String::New(info.Env(), Trace::dump());
+}
 
-  lock.unlock();
+void PlayBackObject::iyuv_callback(ThreadSafeCallback* safe_callback, AVFrame* frame, double pts, int64_t id, const FrameTiming& timing, const Detection_t *det) {
+  TRACE_SCOPE("iyuv_callback");
 
   const auto width = frame->width;
   const auto height = frame->height;
 
   // output yuv
   if (width > 0 && height > 0) {
-    safe_callback->call([this, frame, width, height, id](Napi::Env env, std::vector<napi_value>& args) {
+    // the frame and the record are read on the main loop, hold them until then
+    bool done = false;
+    bool queued = safe_callback->call([this, frame, width, height, id, timing, det, &done](Napi::Env env, std::vector<napi_value>& args) {
       // This will run in main thread and needs to construct the
       // arguments for the call
+      TRACE_SCOPE("yuv to js");
       napi_value jswidth = Napi::Number::New(env, width);
       napi_value jsheight = Napi::Number::New(env, height);
       napi_value frame_id = Napi::Number::New(env, id);
 
-      auto ystride = Napi::Number::New(env, frame->linesize[0]);
-      auto ustride = Napi::Number::New(env, frame->linesize[1]);
-      auto vstride = Napi::Number::New(env, frame->linesize[2]);
-      auto y = Napi::Buffer<uint8_t>::Copy(env, frame->data[0], frame->linesize[0] * height);
-      auto u = Napi::Buffer<uint8_t>::Copy(env, frame->data[1], frame->linesize[1] * height / 2);
-      auto v = Napi::Buffer<uint8_t>::Copy(env, frame->data[2], frame->linesize[2] * height / 2);
-
-      // auto v = Napi::Buffer<uint8_t>::New(env, (uint8_t*)frame->data[2], (size_t)frame->linesize[2] * height / 2, [](Napi::Env, uint8_t*) {});
-
       auto yuv_buffer = Napi::Object::New(env);
 
       yuv_buffer.Set(Napi::String::New(env, "frameId"), frame_id);
       yuv_buffer.Set(Napi::String::New(env, "width"), jswidth);
       yuv_buffer.Set(Napi::String::New(env, "height"), jsheight);
 
-      auto y_obj = Napi::Object::New(env);
-      auto u_obj = Napi::Object::New(env);
-      auto v_obj = Napi::Object::New(env);
-
-      y_obj.Set(Napi::String::New(env, "bytes"), y);
-      y_obj.Set(Napi::String::New(env, "stride"), ystride);
-
-      u_obj.Set(Napi::String::New(env, "bytes"), u);
-      u_obj.Set(Napi::String::New(env, "stride"), ustride);
-
-      v_obj.Set(Napi::String::New(env, "bytes"), v);
-      v_obj.Set(Napi::String::New(env, "stride"), vstride);
+      // planes as the output format lays them out, chroma may be subsampled
+      auto desc = av_pix_fmt_desc_get((AVPixelFormat)frame->format);
+      static const char *plane_names[] = { "y", "u", "v", "a" };
+      for (int i = 0; i < 4 && frame->data[i]; i++) {
+        int plane_height = height;
+        if ((i == 1 || i == 2) && !(desc->flags & AV_PIX_FMT_FLAG_RGB))
+          plane_height = AV_CEIL_RSHIFT(height, desc->log2_chroma_h);
+
+        auto plane = Napi::Object::New(env);
+        plane.Set(Napi::String::New(env, "bytes"), Napi::Buffer<uint8_t>::Copy(env, frame->data[i], frame->linesize[i] * plane_height));
+        plane.Set(Napi::String::New(env, "stride"), Napi::Number::New(env, frame->linesize[i]));
+        yuv_buffer.Set(Napi::String::New(env, plane_names[i]), plane);
+      }
 
-      yuv_buffer.Set(Napi::String::New(env, "y"), y_obj);
-      yuv_buffer.Set(Napi::String::New(env, "u"), u_obj);
-      yuv_buffer.Set(Napi::String::New(env, "v"), v_obj);
+      yuv_buffer.Set(Napi::String::New(env, "format"), Napi::String::New(env, av_get_pix_fmt_name((AVPixelFormat)frame->format)));
+      yuv_buffer.Set(Napi::String::New(env, "bit_depth"), Napi::Number::New(env, desc->comp[0].depth));
+
+      auto color_name = [&](const char *name) -> Napi::Value {
+        if (!name)
+          return env.Null();
+        return Napi::String::New(env, name);
+      };
+      auto color = Napi::Object::New(env);
+      color.Set(Napi::String::New(env, "primaries"), color_name(av_color_primaries_name(frame->color_primaries)));
+      color.Set(Napi::String::New(env, "transfer"), color_name(av_color_transfer_name(frame->color_trc)));
+      color.Set(Napi::String::New(env, "matrix"), color_name(av_color_space_name(frame->colorspace)));
+      color.Set(Napi::String::New(env, "range"), color_name(av_color_range_name(frame->color_range)));
+      yuv_buffer.Set(Napi::String::New(env, "color"), color);
+
+      if (det)
+        yuv_buffer.Set(Napi::String::New(env, "detection"), detectionObject(env, *det, id));
+
+      // seconds since the packet of this picture was demuxed
+      if (timing.demuxed) {
+        int64_t delivered = av_gettime_relative();
+        auto latency = Napi::Object::New(env);
+        latency.Set(Napi::String::New(env, "decode"), Napi::Number::New(env, (timing.decoded - timing.demuxed) / 1000000.0));
+        latency.Set(Napi::String::New(env, "present"), Napi::Number::New(env, (timing.presented - timing.demuxed) / 1000000.0));
+        latency.Set(Napi::String::New(env, "deliver"), Napi::Number::New(env, (delivered - timing.demuxed) / 1000000.0));
+        yuv_buffer.Set(Napi::String::New(env, "latency"), latency);
+
+        std::lock_guard<std::mutex> lk(mtxPlaying_);
+        if (ctx_)
+          ctx_->addDeliveryLatency(delivered - timing.demuxed);
+      }
 
       args = { Napi::String::New(env, "yuv"), yuv_buffer };
+      {
+        lock_guard<mutex> lock(mtx_);
+        done = true;
+      }
       cond_.notify_one();
     });
 
-    lock.lock();
-    cond_.wait(lock);
+    if (queued) {
+      unique_lock<mutex> lock(mtx_);
+      cond_.wait(lock, [&] {
+        return done || safe_callback->aborted();
+      });
+    }
   }
 }
 
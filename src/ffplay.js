@@ -7,6 +7,18 @@ const {PlayBack, Decoder} = binding
 
 inherits(PlayBack, EventEmitter)
 
+// called by the binding with the events of one main loop wakeup, a
+// throwing listener surfaces as an uncaught exception after the batch
+PlayBack.prototype.emitBatch = function (events) {
+  for (const args of events) {
+    try {
+      this.emit(...args)
+    } catch (err) {
+      process.nextTick(() => { throw err })
+    }
+  }
+}
+
 PlayBack.prototype.command = function (...args) {
   this.send(...args)
 }
@@ -47,6 +59,26 @@ PlayBack.prototype.speed = function (v) {
   this.send('speed', 0, v)
 }
 
+// while on, seek_to shows the nearest key frame at once and the exact
+// frame when the position settles
+PlayBack.prototype.scrub = function (on) {
+  this.send('scrub', on ? 1 : 0)
+}
+
+// switches to another -vf entry once its graph is built, playback goes on meanwhile
+PlayBack.prototype.vfilter = function (index) {
+  this.send('vfilter', index)
+}
+
+// target in LUFS, leave it out to keep the current one
+PlayBack.prototype.loudnorm = function (on, target) {
+  this.send('loudnorm', on ? 1 : 0, target || 0)
+}
+
+PlayBack.prototype.trace = function (on) {
+  this.send('trace', on ? 1 : 0)
+}
+
 export {
   PlayBack,
   Decoder